@@ -2,82 +2,1614 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <cctype>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 using namespace std;
 
-string readFile(const string& filename) {
-    ifstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Error: Could not open the file " << filename << endl;
-        exit(1);
+// Container layout (all multi-byte integers are little-endian, "varint" is
+// LEB128):
+//
+//   header   "DRLE" | version (1 byte) | block size (varint) | stage count
+//            (1 byte) | codec id of each pipeline stage (1 byte each)
+//   block    raw size (varint) | encoded size (varint) | CRC-32C of the raw
+//            bytes (4 bytes) | pipeline output, or the raw bytes when the
+//            encoded size equals the raw size
+//   ...
+//   end      raw size 0 (varint)
+//   index    block count (varint) | per block: file offset, raw size (varints)
+//   trailer  index offset (8 bytes) | "DRLI"
+//
+// Blocks are encoded independently, so a reader holding the index can seek
+// straight to any block. Version 1 files have no pipeline in the header and
+// always hold rle packets.
+//
+// The rle stage writes PackBits-style packets. A control byte below 0x80 is followed by
+// control + 1 literal bytes. A control byte c >= 0x80 is followed by a single
+// byte repeated (c & 0x7f) + minRun times; a length field of 0x7f means a
+// varint with the rest of the length comes before the repeated byte.
+const char fileMagic[4] = { 'D', 'R', 'L', 'E' };
+const char indexMagic[4] = { 'D', 'R', 'L', 'I' };
+const uint8_t formatVersion = 2;
+const size_t trailerSize = 12;
+
+// Input is processed in blocks of this size, so memory use stays flat no
+// matter how large the file is.
+const size_t blockSize = 64 * 1024;
+
+const size_t maxLiteral = 128;
+const size_t minRun = 3;
+
+// Worst case is all literals: one control byte per maxLiteral bytes.
+size_t maxEncodedSize(size_t rawSize) {
+    return rawSize + rawSize / maxLiteral + 1;
+}
+
+array<uint32_t, 256> makeCrcTable() {
+    array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        }
+        table[i] = crc;
     }
+    return table;
+}
 
-    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    file.close();
-    return contents;
+uint32_t crc32cScalar(const char* data, size_t size) {
+    static const array<uint32_t, 256> table = makeCrcTable();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = (crc >> 8) ^ table[(crc ^ (uint8_t)data[i]) & 0xFF];
+    }
+    return ~crc;
 }
 
-void writeFile(const string& filename, const string& data) {
-    ofstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Error: Could not write to the file " << filename << endl;
-        exit(1);
+unsigned countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Run-detection kernels. scanRun returns the length of the run of data[0] at
+// the start of data; findRun returns the first position where minRun equal
+// bytes begin, or size if there is none.
+size_t scanRunScalar(const char* data, size_t size) {
+    size_t i = 1;
+    while (i < size && data[i] == data[0]) {
+        ++i;
+    }
+    return i;
+}
+
+size_t findRunScalar(const char* data, size_t size) {
+    for (size_t i = 0; i + 2 < size; ++i) {
+        if (data[i] == data[i + 1] && data[i + 1] == data[i + 2]) {
+            return i;
+        }
     }
+    return size;
+}
 
-    file << data;
-    file.close();
+#if defined(__x86_64__) || defined(_M_X64)
+// SSE2 is part of the x86-64 baseline, so these need no CPU check.
+size_t scanRunSSE2(const char* data, size_t size) {
+    __m128i value = _mm_set1_epi8(data[0]);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        uint32_t mismatch = ~_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, value)) & 0xFFFF;
+        if (mismatch) {
+            return i + countTrailingZeros(mismatch);
+        }
+    }
+    while (i < size && data[i] == data[0]) {
+        ++i;
+    }
+    return i;
 }
 
-string compressRLE(const string& data) {
-    if (data.empty()) return "";
+size_t findRunSSE2(const char* data, size_t size) {
+    size_t i = 0;
+    for (; i + 18 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 2));
+        uint32_t found = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(b, c)));
+        if (found) {
+            return i + countTrailingZeros(found);
+        }
+    }
+    return i + findRunScalar(data + i, size - i);
+}
+#endif
 
-    ostringstream compressed;
-    int n = data.length();
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("avx2")))
+size_t scanRunAVX2(const char* data, size_t size) {
+    __m256i value = _mm256_set1_epi8(data[0]);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+        uint32_t mismatch = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, value));
+        if (mismatch) {
+            return i + countTrailingZeros(mismatch);
+        }
+    }
+    while (i < size && data[i] == data[0]) {
+        ++i;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t findRunAVX2(const char* data, size_t size) {
+    size_t i = 0;
+    for (; i + 34 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(data + i + 2));
+        uint32_t found = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(b, c)));
+        if (found) {
+            return i + countTrailingZeros(found);
+        }
+    }
+    return i + findRunSSE2(data + i, size - i);
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cSSE42(const char* data, size_t size) {
+    uint64_t crc = 0xFFFFFFFF;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    for (; i < size; ++i) {
+        crc = _mm_crc32_u8((uint32_t)crc, data[i]);
+    }
+    return ~(uint32_t)crc;
+}
+#endif
+
+struct Kernels {
+    const char* name;
+    size_t (*scanRun)(const char*, size_t);
+    size_t (*findRun)(const char*, size_t);
+    uint32_t (*crc32c)(const char*, size_t);
+};
+
+// Picks the widest kernels the running CPU supports.
+Kernels selectKernels() {
+    Kernels kernels = { "scalar", scanRunScalar, findRunScalar, crc32cScalar };
+#if defined(__x86_64__) || defined(_M_X64)
+    kernels = { "sse2", scanRunSSE2, findRunSSE2, crc32cScalar };
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernels.crc32c = crc32cSSE42;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.name = "avx2";
+        kernels.scanRun = scanRunAVX2;
+        kernels.findRun = findRunAVX2;
+    }
+#endif
+    return kernels;
+}
+
+const Kernels& kernels() {
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+uint32_t crc32c(const char* data, size_t size) {
+    return kernels().crc32c(data, size);
+}
+
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+void putLE(string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out += (char)(value >> (8 * i));
+    }
+}
+
+uint64_t getLE(const char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= (uint64_t)(uint8_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+// Parses a varint from memory; returns false if it is truncated or too long.
+bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readVarint(istream& in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF) {
+            return false;
+        }
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char* putVarint(char* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (char)value;
+    return out;
+}
+
+char* putLiterals(char* out, const char* data, size_t size) {
+    // Full packets use a fixed-size copy the compiler can inline.
+    while (size >= maxLiteral) {
+        *out++ = (char)(maxLiteral - 1);
+        memcpy(out, data, maxLiteral);
+        out += maxLiteral;
+        data += maxLiteral;
+        size -= maxLiteral;
+    }
+    if (size > 0) {
+        *out++ = (char)(size - 1);
+        memcpy(out, data, size);
+        out += size;
+    }
+    return out;
+}
+
+char* putRun(char* out, char ch, size_t length) {
+    size_t extra = length - minRun;
+    if (extra < 0x7f) {
+        *out++ = (char)(0x80 | extra);
+    }
+    else {
+        *out++ = (char)0xff;
+        out = putVarint(out, extra - 0x7f);
+    }
+    *out++ = ch;
+    return out;
+}
 
-    for (int i = 0; i < n; ++i) {
-        int count = 1;
-        while (i < n - 1 && data[i] == data[i + 1]) {
-            ++count;
-            ++i;
+// Writes the packets for one block to out, which must have room for
+// maxEncodedSize(size) bytes, and returns the number of bytes written.
+size_t encodeBlock(const char* data, size_t size, char* out) {
+    const Kernels& k = kernels();
+    char* p = out;
+    size_t i = 0;
+    while (i < size) {
+        size_t runStart = i + k.findRun(data + i, size - i);
+        p = putLiterals(p, data + i, runStart - i);
+        if (runStart == size) {
+            break;
         }
-        compressed << data[i];
-        if (count > 9) {
-            while (count > 9) {
-                compressed << 9;
-                count -= 9;
+        size_t run = k.scanRun(data + runStart, size - runStart);
+        p = putRun(p, data[runStart], run);
+        i = runStart + run;
+    }
+    return p - out;
+}
+
+// Decodes one block into out, which must hold exactly rawSize bytes. Returns
+// false if the packets are malformed or do not fill the block exactly.
+bool decodeBlock(const char* data, size_t size, char* out, size_t rawSize) {
+    const char* p = data;
+    const char* end = data + size;
+    size_t written = 0;
+    while (p < end) {
+        uint8_t control = *p++;
+        if (control < 0x80) {
+            size_t count = control + 1;
+            if ((size_t)(end - p) < count || rawSize - written < count) {
+                return false;
             }
+            memcpy(out + written, p, count);
+            p += count;
+            written += count;
+            continue;
+        }
+        uint64_t length = control & 0x7f;
+        if (length == 0x7f) {
+            uint64_t extra;
+            if (!getVarint(p, end, extra) || extra > rawSize) {
+                return false;
+            }
+            length += extra;
+        }
+        length += minRun;
+        if (p == end || rawSize - written < length) {
+            return false;
         }
-        compressed << count;
+        memset(out + written, *p++, length);
+        written += length;
     }
+    return written == rawSize;
+}
 
-    return compressed.str();
+// A codec is one stage of a block pipeline. Decoders are told the exact
+// size of their output, so stages do not have to store it themselves.
+class Codec {
+public:
+    Codec(uint8_t id, const char* name) : id(id), name(name) {}
+    virtual ~Codec() {}
+
+    virtual void encode(const char* data, size_t size, string& out) const = 0;
+    virtual bool decode(const char* data, size_t size, char* out, size_t outSize) const = 0;
+
+    const uint8_t id;
+    const char* const name;
+};
+
+class RLECodec : public Codec {
+public:
+    RLECodec() : Codec(1, "rle") {}
+
+    void encode(const char* data, size_t size, string& out) const override {
+        out.resize(maxEncodedSize(size));
+        out.resize(encodeBlock(data, size, &out[0]));
+    }
+
+    bool decode(const char* data, size_t size, char* out, size_t outSize) const override {
+        return decodeBlock(data, size, out, outSize);
+    }
+};
+
+// Move-to-front: recently seen bytes become small numbers, which turns the
+// clustered output of the BWT into long runs of zeros.
+class MTFCodec : public Codec {
+public:
+    MTFCodec() : Codec(2, "mtf") {}
+
+    void encode(const char* data, size_t size, string& out) const override {
+        uint8_t order[256];
+        for (int i = 0; i < 256; ++i) {
+            order[i] = (uint8_t)i;
+        }
+        out.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            uint8_t byte = data[i];
+            uint8_t rank = 0;
+            while (order[rank] != byte) {
+                ++rank;
+            }
+            memmove(order + 1, order, rank);
+            order[0] = byte;
+            out[i] = (char)rank;
+        }
+    }
+
+    bool decode(const char* data, size_t size, char* out, size_t outSize) const override {
+        if (size != outSize) {
+            return false;
+        }
+        uint8_t order[256];
+        for (int i = 0; i < 256; ++i) {
+            order[i] = (uint8_t)i;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            uint8_t rank = data[i];
+            uint8_t byte = order[rank];
+            memmove(order + 1, order, rank);
+            order[0] = byte;
+            out[i] = (char)byte;
+        }
+        return true;
+    }
+};
+
+// Burrows-Wheeler transform over the cyclic rotations of the block. The
+// output is the index of the original rotation (4 bytes) followed by the last
+// column of the sorted rotations.
+class BWTCodec : public Codec {
+public:
+    BWTCodec() : Codec(3, "bwt") {}
+
+    void encode(const char* data, size_t size, string& out) const override {
+        vector<uint32_t> rotations = sortRotations(data, size);
+        out.clear();
+        out.reserve(size + 4);
+        size_t primary = 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (rotations[i] == 0) {
+                primary = i;
+            }
+        }
+        putLE(out, primary, 4);
+        for (size_t i = 0; i < size; ++i) {
+            out += data[(rotations[i] + size - 1) % size];
+        }
+    }
+
+    bool decode(const char* data, size_t size, char* out, size_t outSize) const override {
+        if (size != outSize + 4) {
+            return false;
+        }
+        size_t primary = getLE(data, 4);
+        const uint8_t* last = (const uint8_t*)data + 4;
+        if (outSize == 0 || primary >= outSize) {
+            return outSize == 0;
+        }
+        // next[i] is the row holding the rotation that starts one byte after
+        // row i's; the first column is the last column sorted stably.
+        size_t start[257] = {};
+        for (size_t i = 0; i < outSize; ++i) {
+            ++start[last[i] + 1];
+        }
+        for (int c = 0; c < 256; ++c) {
+            start[c + 1] += start[c];
+        }
+        vector<uint32_t> next(outSize);
+        for (size_t i = 0; i < outSize; ++i) {
+            next[start[last[i]]++] = (uint32_t)i;
+        }
+        size_t row = next[primary];
+        for (size_t i = 0; i < outSize; ++i) {
+            out[i] = (char)last[row];
+            row = next[row];
+        }
+        return true;
+    }
+
+private:
+    // Prefix doubling with counting sorts, O(n log n).
+    static vector<uint32_t> sortRotations(const char* data, size_t size) {
+        vector<uint32_t> order(size);
+        vector<uint32_t> rank(size);
+        vector<uint32_t> shifted(size);
+        vector<uint32_t> nextRank(size);
+        vector<uint32_t> count(max<size_t>(size, 256) + 1);
+
+        for (size_t i = 0; i < size; ++i) {
+            ++count[(uint8_t)data[i]];
+        }
+        for (size_t c = 1; c < 256; ++c) {
+            count[c] += count[c - 1];
+        }
+        for (size_t i = size; i-- > 0;) {
+            order[--count[(uint8_t)data[i]]] = (uint32_t)i;
+        }
+        size_t classes = 1;
+        for (size_t i = 0; i < size; ++i) {
+            if (i > 0 && data[order[i]] != data[order[i - 1]]) {
+                ++classes;
+            }
+            rank[order[i]] = (uint32_t)(classes - 1);
+        }
+
+        for (size_t length = 1; length < size && classes < size; length *= 2) {
+            for (size_t i = 0; i < size; ++i) {
+                shifted[i] = (uint32_t)(order[i] >= length ? order[i] - length : order[i] + size - length);
+            }
+            fill(count.begin(), count.begin() + classes, 0);
+            for (size_t i = 0; i < size; ++i) {
+                ++count[rank[shifted[i]]];
+            }
+            for (size_t c = 1; c < classes; ++c) {
+                count[c] += count[c - 1];
+            }
+            for (size_t i = size; i-- > 0;) {
+                order[--count[rank[shifted[i]]]] = shifted[i];
+            }
+            classes = 1;
+            nextRank[order[0]] = 0;
+            for (size_t i = 1; i < size; ++i) {
+                size_t a = order[i];
+                size_t b = order[i - 1];
+                size_t aNext = a + length < size ? a + length : a + length - size;
+                size_t bNext = b + length < size ? b + length : b + length - size;
+                if (rank[a] != rank[b] || rank[aNext] != rank[bNext]) {
+                    ++classes;
+                }
+                nextRank[a] = (uint32_t)(classes - 1);
+            }
+            rank.swap(nextRank);
+        }
+        return order;
+    }
+};
+
+// Builds code lengths for the given symbol counts with no code longer than
+// maxLength. If the plain Huffman tree is too deep the counts are flattened
+// and the tree rebuilt.
+array<uint8_t, 256> huffmanLengths(array<uint64_t, 256> counts, int maxLength) {
+    while (true) {
+        array<uint8_t, 256> lengths = {};
+        vector<pair<uint64_t, int>> heap;   // (weight, node)
+        vector<int> parent;
+        for (int s = 0; s < 256; ++s) {
+            if (counts[s] > 0) {
+                heap.push_back({ counts[s], (int)parent.size() });
+                parent.push_back(-1);
+            }
+        }
+        size_t leaves = parent.size();
+        if (leaves == 1) {
+            for (int s = 0; s < 256; ++s) {
+                if (counts[s] > 0) {
+                    lengths[s] = 1;
+                }
+            }
+            return lengths;
+        }
+        auto greater = [](const pair<uint64_t, int>& a, const pair<uint64_t, int>& b) { return a > b; };
+        make_heap(heap.begin(), heap.end(), greater);
+        while (heap.size() > 1) {
+            pop_heap(heap.begin(), heap.end(), greater);
+            pair<uint64_t, int> a = heap.back();
+            heap.pop_back();
+            pop_heap(heap.begin(), heap.end(), greater);
+            pair<uint64_t, int> b = heap.back();
+            heap.pop_back();
+            int node = (int)parent.size();
+            parent.push_back(-1);
+            parent[a.second] = node;
+            parent[b.second] = node;
+            heap.push_back({ a.first + b.first, node });
+            push_heap(heap.begin(), heap.end(), greater);
+        }
+
+        bool fits = true;
+        size_t leaf = 0;
+        for (int s = 0; s < 256; ++s) {
+            if (counts[s] == 0) {
+                continue;
+            }
+            int depth = 0;
+            for (int node = (int)leaf++; parent[node] != -1; node = parent[node]) {
+                ++depth;
+            }
+            fits = fits && depth <= maxLength;
+            lengths[s] = (uint8_t)depth;
+        }
+        if (fits) {
+            return lengths;
+        }
+        for (uint64_t& count : counts) {
+            if (count > 0) {
+                count = (count + 1) / 2;
+            }
+        }
+    }
 }
 
-string decompressRLE(const string& data) {
-    ostringstream decompressed;
-    int n = data.length();
+// Canonical Huffman coding. The output starts with the code length of every
+// byte value packed into 128 nibbles, followed by the codes, MSB first.
+class HuffmanCodec : public Codec {
+public:
+    HuffmanCodec() : Codec(4, "huff") {}
 
-    for (int i = 0; i < n; ++i) {
-        char ch = data[i];
-        ++i;
-        int count = data[i] - '0';
-        decompressed << string(count, ch);
+    void encode(const char* data, size_t size, string& out) const override {
+        array<uint64_t, 256> counts = {};
+        for (size_t i = 0; i < size; ++i) {
+            ++counts[(uint8_t)data[i]];
+        }
+        array<uint8_t, 256> lengths = huffmanLengths(counts, maxCodeLength);
+        array<uint32_t, 256> codes = canonicalCodes(lengths);
+
+        out.clear();
+        out.reserve(128 + size);
+        for (int s = 0; s < 256; s += 2) {
+            out += (char)(lengths[s] | (lengths[s + 1] << 4));
+        }
+        uint64_t bits = 0;
+        int pending = 0;
+        for (size_t i = 0; i < size; ++i) {
+            uint8_t s = data[i];
+            bits = (bits << lengths[s]) | codes[s];
+            pending += lengths[s];
+            while (pending >= 8) {
+                pending -= 8;
+                out += (char)(bits >> pending);
+            }
+        }
+        if (pending > 0) {
+            out += (char)(bits << (8 - pending));
+        }
+    }
+
+    bool decode(const char* data, size_t size, char* out, size_t outSize) const override {
+        if (size < 128) {
+            return false;
+        }
+        // Per code length: how many codes there are, and the symbols in
+        // canonical order (the decoding scheme of zlib's puff).
+        int lengthCount[maxCodeLength + 1] = {};
+        int offsets[maxCodeLength + 2] = {};
+        uint8_t symbols[256];
+        uint8_t lengths[256];
+        for (int s = 0; s < 256; ++s) {
+            uint8_t packed = data[s / 2];
+            lengths[s] = (s & 1) ? packed >> 4 : packed & 0x0f;
+            ++lengthCount[lengths[s]];
+        }
+        for (int len = 1; len <= maxCodeLength; ++len) {
+            offsets[len + 1] = offsets[len] + lengthCount[len];
+        }
+        for (int s = 0; s < 256; ++s) {
+            if (lengths[s] > 0) {
+                symbols[offsets[lengths[s]]++] = (uint8_t)s;
+            }
+        }
+
+        const uint8_t* p = (const uint8_t*)data + 128;
+        const uint8_t* end = (const uint8_t*)data + size;
+        int bitPos = 0;
+        for (size_t i = 0; i < outSize; ++i) {
+            int code = 0;
+            int first = 0;
+            int index = 0;
+            int len = 1;
+            for (;; ++len) {
+                if (len > maxCodeLength || p == end) {
+                    return false;
+                }
+                code |= (*p >> (7 - bitPos)) & 1;
+                if (++bitPos == 8) {
+                    bitPos = 0;
+                    ++p;
+                }
+                int count = lengthCount[len];
+                if (code - first < count) {
+                    break;
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            out[i] = (char)symbols[index + code - first];
+        }
+        return true;
+    }
+
+private:
+    static const int maxCodeLength = 15;
+
+    static array<uint32_t, 256> canonicalCodes(const array<uint8_t, 256>& lengths) {
+        array<uint32_t, 256> codes = {};
+        uint32_t code = 0;
+        for (int len = 1; len <= maxCodeLength; ++len) {
+            for (int s = 0; s < 256; ++s) {
+                if (lengths[s] == len) {
+                    codes[s] = code++;
+                }
+            }
+            code <<= 1;
+        }
+        return codes;
+    }
+};
+
+// Order-0 range asymmetric numeral system coder with 12-bit frequencies and
+// byte-wise renormalisation. The output is a 32-byte bitmap of the byte
+// values present, their frequencies as varints, then the coded bytes.
+class RANSCodec : public Codec {
+public:
+    RANSCodec() : Codec(5, "rans") {}
+
+    void encode(const char* data, size_t size, string& out) const override {
+        array<uint64_t, 256> counts = {};
+        for (size_t i = 0; i < size; ++i) {
+            ++counts[(uint8_t)data[i]];
+        }
+        array<uint32_t, 256> freqs = normalize(counts, size);
+        array<uint32_t, 257> starts = cumulative(freqs);
+
+        out.assign(32, '\0');
+        for (int s = 0; s < 256; ++s) {
+            if (freqs[s] > 0) {
+                out[s / 8] |= (char)(1 << (s % 8));
+            }
+        }
+        for (int s = 0; s < 256; ++s) {
+            if (freqs[s] > 0) {
+                putVarint(out, freqs[s]);
+            }
+        }
+
+        // rANS decodes in the reverse order it encodes, so the symbols are
+        // coded back to front and the bytes reversed at the end.
+        string coded;
+        coded.reserve(size + 4);
+        uint32_t state = lowerBound;
+        for (size_t i = size; i-- > 0;) {
+            uint8_t s = data[i];
+            uint32_t limit = ((lowerBound >> scaleBits) << 8) * freqs[s];
+            while (state >= limit) {
+                coded += (char)state;
+                state >>= 8;
+            }
+            state = ((state / freqs[s]) << scaleBits) + state % freqs[s] + starts[s];
+        }
+        for (int i = 0; i < 4; ++i) {
+            coded += (char)(state >> (8 * i));
+        }
+        out.append(coded.rbegin(), coded.rend());
+    }
+
+    bool decode(const char* data, size_t size, char* out, size_t outSize) const override {
+        const char* p = data + 32;
+        const char* end = data + size;
+        if (size < 32) {
+            return false;
+        }
+        array<uint32_t, 256> freqs = {};
+        uint32_t total = 0;
+        for (int s = 0; s < 256; ++s) {
+            if (data[s / 8] & (1 << (s % 8))) {
+                uint64_t freq;
+                if (!getVarint(p, end, freq) || freq == 0 || freq > scale) {
+                    return false;
+                }
+                freqs[s] = (uint32_t)freq;
+                total += (uint32_t)freq;
+            }
+        }
+        if (total != scale || end - p < 4) {
+            return false;
+        }
+        array<uint32_t, 257> starts = cumulative(freqs);
+        vector<uint8_t> slotSymbol(scale);
+        for (int s = 0; s < 256; ++s) {
+            fill(slotSymbol.begin() + starts[s], slotSymbol.begin() + starts[s + 1], (uint8_t)s);
+        }
+
+        uint32_t state = 0;
+        for (int i = 0; i < 4; ++i) {
+            state = (state << 8) | (uint8_t)*p++;
+        }
+        for (size_t i = 0; i < outSize; ++i) {
+            uint32_t slot = state & (scale - 1);
+            uint8_t s = slotSymbol[slot];
+            out[i] = (char)s;
+            state = freqs[s] * (state >> scaleBits) + slot - starts[s];
+            while (state < lowerBound) {
+                if (p == end) {
+                    return false;
+                }
+                state = (state << 8) | (uint8_t)*p++;
+            }
+        }
+        return p == end && state == lowerBound;
+    }
+
+private:
+    static const int scaleBits = 12;
+    static const uint32_t scale = 1u << scaleBits;
+    static const uint32_t lowerBound = 1u << 23;
+
+    // Scales the counts to sum to exactly scale, keeping every present
+    // symbol at a frequency of at least 1.
+    static array<uint32_t, 256> normalize(const array<uint64_t, 256>& counts, size_t total) {
+        array<uint32_t, 256> freqs = {};
+        uint32_t sum = 0;
+        for (int s = 0; s < 256; ++s) {
+            if (counts[s] > 0) {
+                freqs[s] = max<uint32_t>(1, (uint32_t)(counts[s] * scale / total));
+                sum += freqs[s];
+            }
+        }
+        while (sum != scale) {
+            int largest = (int)(max_element(freqs.begin(), freqs.end()) - freqs.begin());
+            if (sum < scale) {
+                freqs[largest] += scale - sum;
+                sum = scale;
+            }
+            else {
+                uint32_t excess = min(sum - scale, freqs[largest] - 1);
+                freqs[largest] -= excess;
+                sum -= excess;
+            }
+        }
+        return freqs;
+    }
+
+    static array<uint32_t, 257> cumulative(const array<uint32_t, 256>& freqs) {
+        array<uint32_t, 257> starts = {};
+        for (int s = 0; s < 256; ++s) {
+            starts[s + 1] = starts[s] + freqs[s];
+        }
+        return starts;
+    }
+};
+
+const RLECodec rleCodec;
+const MTFCodec mtfCodec;
+const BWTCodec bwtCodec;
+const HuffmanCodec huffmanCodec;
+const RANSCodec ransCodec;
+const Codec* const codecs[] = { &rleCodec, &mtfCodec, &bwtCodec, &huffmanCodec, &ransCodec };
+
+const Codec* findCodec(uint8_t id) {
+    for (const Codec* codec : codecs) {
+        if (codec->id == id) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+const Codec* findCodec(const string& name) {
+    for (const Codec* codec : codecs) {
+        if (name == codec->name) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+// Upper bound for any intermediate stage output. Encoders give up on
+// pipelines that exceed it, and decoders use it to reject corrupt size fields
+// before allocating.
+size_t maxStageSize(size_t rawSize) {
+    return 2 * rawSize + 1024;
+}
+
+// Compression levels for "auto"; higher levels try slower pipelines.
+const int minLevel = 1;
+const int maxLevel = 9;
+
+// The chain of codecs applied to each block, first stage first. A pipeline
+// with no stages stands for "auto": the compressor picks one by sampling,
+// trying the candidates allowed at the given level.
+//
+// An encoded block starts with the output size of every stage but the last
+// (varints), followed by the output of the last stage.
+struct Pipeline {
+    vector<const Codec*> stages;
+    int level = maxLevel;
+
+    string name() const {
+        if (stages.empty()) {
+            return "auto";
+        }
+        string joined;
+        for (const Codec* stage : stages) {
+            joined += (joined.empty() ? "" : "+") + string(stage->name);
+        }
+        return joined;
+    }
+
+    // Returns false if an intermediate stage grew past maxStageSize.
+    bool encode(const char* data, size_t size, string& out) const {
+        if (stages.size() == 1) {
+            stages[0]->encode(data, size, out);
+            return true;
+        }
+        size_t maxSize = maxStageSize(size);
+        string buffers[2];
+        string sizes;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            string& target = buffers[i % 2];
+            stages[i]->encode(data, size, target);
+            data = target.data();
+            size = target.size();
+            if (i + 1 < stages.size()) {
+                if (size > maxSize) {
+                    return false;
+                }
+                putVarint(sizes, size);
+            }
+        }
+        out = sizes;
+        out.append(data, size);
+        return true;
     }
 
+    bool decode(const char* data, size_t size, char* out, size_t rawSize) const {
+        if (stages.size() == 1) {
+            return stages[0]->decode(data, size, out, rawSize);
+        }
+        const char* p = data;
+        const char* end = data + size;
+        size_t maxSize = maxStageSize(rawSize);
+        vector<size_t> sizes(stages.size());
+        sizes[0] = rawSize;
+        for (size_t i = 1; i < stages.size(); ++i) {
+            uint64_t stageSize;
+            if (!getVarint(p, end, stageSize) || stageSize > maxSize) {
+                return false;
+            }
+            sizes[i] = stageSize;
+        }
+        string input(p, end);
+        string output;
+        for (size_t i = stages.size(); i-- > 1;) {
+            output.resize(sizes[i]);
+            if (!stages[i]->decode(input.data(), input.size(), &output[0], output.size())) {
+                return false;
+            }
+            input.swap(output);
+        }
+        return stages[0]->decode(input.data(), input.size(), out, rawSize);
+    }
+};
+
+// Parses a pipeline such as "bwt+mtf+rle+huff", or "auto".
+bool parsePipeline(const string& spec, Pipeline& pipeline) {
+    pipeline.stages.clear();
+    if (spec == "auto") {
+        return true;
+    }
+    stringstream parts(spec);
+    string name;
+    while (getline(parts, name, '+')) {
+        const Codec* codec = findCodec(name);
+        if (!codec) {
+            return false;
+        }
+        pipeline.stages.push_back(codec);
+    }
+    return !pipeline.stages.empty() && pipeline.stages.size() < 256;
+}
+
+Pipeline rlePipeline() {
+    return Pipeline{ { &rleCodec } };
+}
+
+struct AutoCandidate {
+    const char* spec;
+    int level;  // lowest level that tries it
+};
+
+// Candidates for "auto", cheapest first; a later candidate has to be
+// strictly smaller to win.
+const AutoCandidate autoPipelines[] = {
+    { "rle", 1 },
+    { "huff", 2 },
+    { "rle+huff", 2 },
+    { "rans", 4 },
+    { "rle+rans", 4 },
+    { "bwt+mtf+rle+huff", 7 },
+    { "bwt+mtf+rle+rans", 8 },
+};
+
+Pipeline choosePipeline(const char* sample, size_t size, int level = maxLevel) {
+    Pipeline best = rlePipeline();
+    if (size == 0) {
+        return best;
+    }
+    size_t bestSize = SIZE_MAX;
+    string encoded;
+    for (const AutoCandidate& entry : autoPipelines) {
+        if (entry.level > level) {
+            continue;
+        }
+        Pipeline candidate;
+        parsePipeline(entry.spec, candidate);
+        if (candidate.encode(sample, size, encoded) && encoded.size() < bestSize) {
+            best = candidate;
+            bestSize = encoded.size();
+        }
+    }
+    return best;
+}
+
+// Encodes one block for a record. Blocks the pipeline cannot shrink are
+// stored as they are; readers recognise them by encoded size == raw size.
+void encodeRecord(const Pipeline& pipeline, const char* data, size_t size, string& out) {
+    if (!pipeline.encode(data, size, out) || out.size() >= size) {
+        out.assign(data, size);
+    }
+}
+
+struct BlockInfo {
+    uint64_t offset;     // file offset of the block record
+    uint64_t rawOffset;  // offset of the block's first byte in the original data
+    uint64_t rawSize;
+};
+
+// Incremental container writer. Input is buffered into blocks of
+// blockSize bytes; each full block is encoded and written immediately.
+class RLEEncoder {
+public:
+    RLEEncoder(ostream& out, const Pipeline& pipeline = rlePipeline()) : out(out), pipeline(pipeline) {
+        string header(fileMagic, sizeof(fileMagic));
+        header += (char)formatVersion;
+        putVarint(header, blockSize);
+        header += (char)pipeline.stages.size();
+        for (const Codec* stage : pipeline.stages) {
+            header += (char)stage->id;
+        }
+        emit(header);
+        raw.reserve(blockSize);
+    }
+
+    void write(const char* data, size_t size) {
+        while (size > 0) {
+            size_t count = min(size, blockSize - raw.size());
+            raw.append(data, count);
+            data += count;
+            size -= count;
+            if (raw.size() == blockSize) {
+                flushBlock();
+            }
+        }
+    }
+
+    void finish() {
+        flushBlock();
+        string tail;
+        putVarint(tail, 0);
+        uint64_t indexOffset = written + tail.size();
+        putVarint(tail, index.size());
+        for (const BlockInfo& block : index) {
+            putVarint(tail, block.offset);
+            putVarint(tail, block.rawSize);
+        }
+        putLE(tail, indexOffset, 8);
+        tail.append(indexMagic, sizeof(indexMagic));
+        emit(tail);
+    }
+
+    // Writes a block that was already encoded elsewhere, e.g. on a worker
+    // thread. Blocks must arrive in input order.
+    void appendBlock(size_t rawSize, const char* data, size_t encodedSize, uint32_t crc) {
+        string record;
+        putVarint(record, rawSize);
+        putVarint(record, encodedSize);
+        putLE(record, crc, 4);
+
+        index.push_back({ written, rawWritten, rawSize });
+        rawWritten += rawSize;
+        emit(record);
+        emit(data, encodedSize);
+    }
+
+private:
+    void flushBlock() {
+        if (raw.empty()) {
+            return;
+        }
+        encodeRecord(pipeline, raw.data(), raw.size(), encoded);
+        appendBlock(raw.size(), encoded.data(), encoded.size(), crc32c(raw.data(), raw.size()));
+        raw.clear();
+    }
+
+    void emit(const string& data) {
+        emit(data.data(), data.size());
+    }
+
+    void emit(const char* data, size_t size) {
+        out.write(data, size);
+        written += size;
+    }
+
+    ostream& out;
+    Pipeline pipeline;
+    string raw;
+    string encoded;
+    vector<BlockInfo> index;
+    uint64_t written = 0;
+    uint64_t rawWritten = 0;
+};
+
+// Reads the block record at the current position of in without decoding it.
+// Returns false at the end marker or on corrupt input; corrupt is set in the
+// second case.
+bool readBlockRecord(istream& in, size_t maxBlockSize, string& encoded, size_t& rawSize, uint32_t& crc,
+    bool& corrupt) {
+    uint64_t size;
+    corrupt = true;
+    if (!readVarint(in, size) || size > maxBlockSize) {
+        return false;
+    }
+    if (size == 0) {
+        corrupt = false;
+        return false;
+    }
+    uint64_t encodedSize;
+    char checksum[4];
+    if (!readVarint(in, encodedSize) || encodedSize > maxEncodedSize(maxBlockSize) || !in.read(checksum, 4)) {
+        return false;
+    }
+    encoded.resize(encodedSize);
+    if (!in.read(&encoded[0], encodedSize)) {
+        return false;
+    }
+    rawSize = size;
+    crc = (uint32_t)getLE(checksum, 4);
+    corrupt = false;
+    return true;
+}
+
+struct ContainerInfo {
+    int version = 0;
+    size_t blockSize = 0;
+    Pipeline pipeline;
+};
+
+// Decodes a record read by readBlockRecord and verifies its checksum.
+bool decodeRecord(const ContainerInfo& info, const string& encoded, size_t rawSize, uint32_t crc, string& raw) {
+    raw.resize(rawSize);
+    if (info.version >= 2 && encoded.size() == rawSize) {
+        memcpy(&raw[0], encoded.data(), rawSize);
+    }
+    else if (!info.pipeline.decode(encoded.data(), encoded.size(), &raw[0], rawSize)) {
+        return false;
+    }
+    return crc32c(raw.data(), raw.size()) == crc;
+}
+
+bool readBlock(istream& in, const ContainerInfo& info, string& encoded, string& raw, bool& corrupt) {
+    size_t rawSize;
+    uint32_t crc;
+    if (!readBlockRecord(in, info.blockSize, encoded, rawSize, crc, corrupt)) {
+        return false;
+    }
+    corrupt = !decodeRecord(info, encoded, rawSize, crc, raw);
+    return !corrupt;
+}
+
+// Reads the container header; returns false if in does not start with a
+// supported container.
+bool readHeader(istream& in, ContainerInfo& info) {
+    char magic[4];
+    uint64_t size;
+    if (!in.read(magic, 4) || memcmp(magic, fileMagic, 4) != 0) {
+        return false;
+    }
+    info.version = in.get();
+    if (info.version < 1 || info.version > formatVersion || !readVarint(in, size) || size == 0 ||
+        size > (1u << 30)) {
+        return false;
+    }
+    info.blockSize = size;
+    if (info.version == 1) {
+        info.pipeline = rlePipeline();
+        return true;
+    }
+    int count = in.get();
+    if (count == EOF || count == 0) {
+        return false;
+    }
+    info.pipeline.stages.clear();
+    for (int i = 0; i < count; ++i) {
+        int id = in.get();
+        const Codec* codec = id == EOF ? nullptr : findCodec((uint8_t)id);
+        if (!codec) {
+            return false;
+        }
+        info.pipeline.stages.push_back(codec);
+    }
+    return true;
+}
+
+bool hasMagic(istream& in) {
+    char magic[4];
+    bool found = in.read(magic, 4) && memcmp(magic, fileMagic, 4) == 0;
+    in.clear();
+    in.seekg(0);
+    return found;
+}
+
+// Thread pool with one task queue per worker. Tasks are dealt out round-robin;
+// a worker whose queue runs dry steals from the others, so a few slow blocks
+// do not leave the remaining threads idle. Every queue is served oldest
+// first because blocks are written back in input order.
+class WorkStealingPool {
+public:
+    WorkStealingPool(size_t threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            queues.push_back(make_unique<TaskQueue>());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(&WorkStealingPool::run, this, i);
+        }
+    }
+
+    // Runs every task already submitted, then stops the workers.
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(idleLock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(function<void()> task) {
+        TaskQueue& queue = *queues[nextQueue++ % queues.size()];
+        {
+            lock_guard<mutex> lock(queue.lock);
+            queue.tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> lock(idleLock);
+            ++pending;
+        }
+        idle.notify_one();
+    }
+
+private:
+    struct TaskQueue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    bool takeTask(size_t self, function<void()>& task) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            TaskQueue& queue = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> lock(queue.lock);
+            if (!queue.tasks.empty()) {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        while (true) {
+            {
+                unique_lock<mutex> lock(idleLock);
+                idle.wait(lock, [this] { return pending > 0 || stopping; });
+                if (pending == 0) {
+                    return;
+                }
+                --pending;
+            }
+            // Claiming from pending guarantees a task is queued somewhere for
+            // this worker, even if another thread wins the first scan.
+            function<void()> task;
+            while (!takeTask(self, task)) {
+            }
+            task();
+        }
+    }
+
+    vector<unique_ptr<TaskQueue>> queues;
+    vector<thread> workers;
+    size_t nextQueue = 0;
+    mutex idleLock;
+    condition_variable idle;
+    size_t pending = 0;
+    bool stopping = false;
+};
+
+struct BlockSlot {
+    string raw;
+    string encoded;
+    size_t rawSize = 0;
+    uint32_t crc = 0;
+    bool valid = true;
+    bool done = false;
+};
+
+// Holds the blocks in flight between the reader, the workers and the writer.
+// Block n lives in slot n % window, so at most window blocks are buffered and
+// the writer collects them in input order however the workers finish.
+class ReorderBuffer {
+public:
+    ReorderBuffer(size_t window) : slots(window) {}
+
+    size_t window() const {
+        return slots.size();
+    }
+
+    BlockSlot& slot(uint64_t sequence) {
+        return slots[sequence % slots.size()];
+    }
+
+    void complete(uint64_t sequence) {
+        {
+            lock_guard<mutex> guard(lock);
+            slot(sequence).done = true;
+        }
+        ready.notify_all();
+    }
+
+    BlockSlot& wait(uint64_t sequence) {
+        BlockSlot& block = slot(sequence);
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [&block] { return block.done; });
+        block.done = false;
+        return block;
+    }
+
+private:
+    vector<BlockSlot> slots;
+    mutex lock;
+    condition_variable ready;
+};
+
+// Blocks kept in flight per worker thread.
+const size_t blocksPerThread = 4;
+
+// An empty pipeline picks one by sampling the first block.
+bool compressStream(istream& in, ostream& out, size_t threads = 1, const Pipeline& requested = rlePipeline()) {
+    string first(blockSize, '\0');
+    in.read(&first[0], first.size());
+    first.resize(in.gcount());
+    Pipeline pipeline = requested;
+    if (pipeline.stages.empty()) {
+        pipeline = choosePipeline(first.data(), first.size(), requested.level);
+    }
+
+    RLEEncoder encoder(out, pipeline);
+    if (threads <= 1) {
+        encoder.write(first.data(), first.size());
+        vector<char> block(blockSize);
+        while (in) {
+            in.read(block.data(), block.size());
+            encoder.write(block.data(), in.gcount());
+        }
+        encoder.finish();
+        return (bool)out;
+    }
+
+    ReorderBuffer blocks(threads * blocksPerThread);
+    WorkStealingPool pool(threads);
+    uint64_t submitted = 0;
+    uint64_t written = 0;
+    while (true) {
+        while (submitted - written < blocks.window()) {
+            BlockSlot& slot = blocks.slot(submitted);
+            if (submitted == 0) {
+                slot.raw.swap(first);
+            }
+            else {
+                slot.raw.resize(blockSize);
+                in.read(&slot.raw[0], blockSize);
+                slot.raw.resize(in.gcount());
+            }
+            if (slot.raw.empty()) {
+                break;
+            }
+            pool.submit([&blocks, &slot, &pipeline, sequence = submitted] {
+                encodeRecord(pipeline, slot.raw.data(), slot.raw.size(), slot.encoded);
+                slot.crc = crc32c(slot.raw.data(), slot.raw.size());
+                blocks.complete(sequence);
+            });
+            ++submitted;
+        }
+        if (written == submitted) {
+            break;
+        }
+        BlockSlot& slot = blocks.wait(written++);
+        encoder.appendBlock(slot.raw.size(), slot.encoded.data(), slot.encoded.size(), slot.crc);
+    }
+    encoder.finish();
+    return (bool)out;
+}
+
+// Decodes a whole container front to back; the index is not needed.
+bool decompressStream(istream& in, ostream& out, size_t threads = 1) {
+    ContainerInfo info;
+    if (!readHeader(in, info)) {
+        return false;
+    }
+    bool corrupt = false;
+    if (threads <= 1) {
+        string encoded;
+        string raw;
+        while (readBlock(in, info, encoded, raw, corrupt)) {
+            out.write(raw.data(), raw.size());
+        }
+        return !corrupt && out;
+    }
+
+    ReorderBuffer blocks(threads * blocksPerThread);
+    WorkStealingPool pool(threads);
+    uint64_t submitted = 0;
+    uint64_t written = 0;
+    bool more = true;
+    bool badBlock = false;
+    while (true) {
+        while (more && submitted - written < blocks.window()) {
+            BlockSlot& slot = blocks.slot(submitted);
+            if (!readBlockRecord(in, info.blockSize, slot.encoded, slot.rawSize, slot.crc, corrupt)) {
+                more = false;
+                break;
+            }
+            pool.submit([&blocks, &slot, &info, sequence = submitted] {
+                slot.valid = decodeRecord(info, slot.encoded, slot.rawSize, slot.crc, slot.raw);
+                blocks.complete(sequence);
+            });
+            ++submitted;
+        }
+        if (written == submitted) {
+            break;
+        }
+        // As in the single-threaded path, every block before the first bad
+        // record or block is written; after a bad block the remaining ones
+        // are only drained.
+        BlockSlot& slot = blocks.wait(written++);
+        if (!slot.valid) {
+            badBlock = true;
+            more = false;
+        }
+        if (!badBlock) {
+            out.write(slot.raw.data(), slot.raw.size());
+        }
+    }
+    return !corrupt && !badBlock && out;
+}
+
+// Loads the block index from the trailer of a seekable container.
+bool readIndex(istream& in, vector<BlockInfo>& index) {
+    in.seekg(0, ios::end);
+    uint64_t fileSize = in.tellg();
+    char trailer[trailerSize];
+    if (fileSize < trailerSize || !in.seekg(fileSize - trailerSize) || !in.read(trailer, trailerSize) ||
+        memcmp(trailer + 8, indexMagic, 4) != 0) {
+        return false;
+    }
+    uint64_t indexOffset = getLE(trailer, 8);
+    if (indexOffset >= fileSize - trailerSize) {
+        return false;
+    }
+    string data(fileSize - trailerSize - indexOffset, '\0');
+    in.seekg(indexOffset);
+    if (!in.read(&data[0], data.size())) {
+        return false;
+    }
+
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t count;
+    if (!getVarint(p, end, count) || count > data.size()) {
+        return false;
+    }
+    index.clear();
+    uint64_t rawOffset = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        BlockInfo block;
+        if (!getVarint(p, end, block.offset) || !getVarint(p, end, block.rawSize)) {
+            return false;
+        }
+        block.rawOffset = rawOffset;
+        rawOffset += block.rawSize;
+        index.push_back(block);
+    }
+    return true;
+}
+
+// Writes length bytes of the original data starting at start, decoding only
+// the blocks that overlap the range.
+bool decompressRange(istream& in, ostream& out, uint64_t start, uint64_t length) {
+    ContainerInfo info;
+    vector<BlockInfo> index;
+    if (!readHeader(in, info) || !readIndex(in, index)) {
+        return false;
+    }
+    auto it = upper_bound(index.begin(), index.end(), start,
+        [](uint64_t offset, const BlockInfo& block) { return offset < block.rawOffset; });
+    if (it != index.begin()) {
+        --it;
+    }
+    string encoded;
+    string raw;
+    bool corrupt;
+    for (; it != index.end() && length > 0; ++it) {
+        in.clear();
+        in.seekg(it->offset);
+        if (!readBlock(in, info, encoded, raw, corrupt) || raw.size() != it->rawSize) {
+            return false;
+        }
+        uint64_t skip = start > it->rawOffset ? start - it->rawOffset : 0;
+        if (skip >= raw.size()) {
+            continue;
+        }
+        uint64_t count = min<uint64_t>(raw.size() - skip, length);
+        out.write(raw.data() + skip, count);
+        length -= count;
+    }
+    return length == 0;
+}
+
+string compressRLE(const string& data, const Pipeline& pipeline = rlePipeline()) {
+    istringstream in(data);
+    ostringstream compressed;
+    compressStream(in, compressed, 1, pipeline);
+    return compressed.str();
+}
+
+string decompressRLE(const string& data) {
+    istringstream compressed(data);
+    ostringstream decompressed;
+    decompressStream(compressed, decompressed);
     return decompressed.str();
 }
 
 bool isCompressed(const string& data) {
-    for (char ch : data) {
-        if (isdigit(ch)) {
-            return true;
+    return data.compare(0, 4, fileMagic, 4) == 0;
+}
+
+// Older versions of this tool wrote each run as the character followed by a
+// single digit count. Such files are still accepted for decompression.
+bool legacyDecode(istream& in, ostream* out) {
+    string buffer;
+    char token[2];
+    while (in.read(token, 2)) {
+        int count = token[1] - '0';
+        if (count < 1 || count > 9) {
+            return false;
+        }
+        if (out) {
+            buffer.append(count, token[0]);
+            if (buffer.size() >= blockSize) {
+                out->write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
         }
     }
-    return false;
+    if (in.gcount() != 0) {
+        return false;
+    }
+    if (out) {
+        out->write(buffer.data(), buffer.size());
+    }
+    return true;
+}
+
+bool isLegacyCompressed(istream& in) {
+    bool valid = legacyDecode(in, nullptr);
+    in.clear();
+    in.seekg(0);
+    return valid;
 }
 
-int main() {
+// Prompts for one file at a time; used when the tool is started without
+// arguments.
+int interactive() {
+    size_t threads = max(1u, thread::hardware_concurrency());
+    Pipeline pipeline;  // auto: chosen per file from its first block
+
     while (true) {
         string choice;
         string inputFile;
@@ -96,38 +1628,240 @@ int main() {
         cout << "Enter output file name: ";
         cin >> outputFile;
 
-        string fileContents = readFile(inputFile);
-        string result;
+        ifstream input(inputFile, ios::binary);
+        if (!input) {
+            cerr << "Error: Could not open the file " << inputFile << endl;
+            exit(1);
+        }
+
+        bool container = hasMagic(input);
+        bool legacy = choice == "d" && !container && isLegacyCompressed(input);
 
-        if (choice == "c") {
-            if (isCompressed(fileContents)) {
-                cerr << "Compression not possible: file is already compressed." << endl;
+        if (choice == "c" && container) {
+            cerr << "Compression not possible: file is already compressed." << endl;
+        }
+        else if (choice == "d" && !container && !legacy) {
+            cerr << "Decompression not possible: file is already in original form." << endl;
+        }
+        else {
+            ofstream output(outputFile, ios::binary);
+            if (!output) {
+                cerr << "Error: Could not write to the file " << outputFile << endl;
+                exit(1);
             }
-            else {
-                result = compressRLE(fileContents);
-                writeFile(outputFile, result);
-                cout << "File compressed successfully." << endl;
+
+            if (choice == "c") {
+                if (compressStream(input, output, threads, pipeline)) {
+                    cout << "File compressed successfully." << endl;
+                }
+                else {
+                    cerr << "Compression failed: could not write " << outputFile << endl;
+                }
             }
-        }
-        else if (choice == "d") {
-            if (!isCompressed(fileContents)) {
-                cerr << "Decompression not possible: file is already in original form." << endl;
+            else if (legacy ? legacyDecode(input, &output) : decompressStream(input, output, threads)) {
+                cout << "File decompressed successfully." << endl;
             }
             else {
-                result = decompressRLE(fileContents);
-                writeFile(outputFile, result);
-                cout << "File decompressed successfully." << endl;
+                cerr << "Decompression failed: file is corrupt." << endl;
             }
         }
 
         char cont;
         cout << "Press 'q' to quit or any other key to continue: ";
         cin >> cont;
-        system("cls");
         if (cont == 'q') {
             break;
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+const char* const compressedSuffix = ".drle";
+
+struct Options {
+    char mode = 0;                      // 'c' or 'd'
+    Pipeline pipeline;                  // empty: auto at pipeline.level
+    size_t threads = 1;
+    string output;                      // only with a single input; "-" is stdout
+    bool force = false;
+    bool range = false;
+    uint64_t rangeStart = 0;
+    uint64_t rangeLength = 0;
+    vector<string> inputs;              // "-" is stdin
+};
+
+void usage() {
+    cerr << "Usage: ConsoleApplication1 -c|-d [-1..-9] [-p PIPELINE] [-j N] [-o FILE|-] [-f]\n"
+         << "                           [-r START:LENGTH] [FILE|-]...\n"
+         << "  -c          compress; FILE is written to FILE" << compressedSuffix << "\n"
+         << "  -d          decompress; FILE" << compressedSuffix << " is written to FILE\n"
+         << "  -1..-9      try faster (1) or stronger (9) pipelines in auto mode (default 9)\n"
+         << "  -p PIPELINE use a fixed pipeline, e.g. rle or bwt+mtf+rle+huff\n"
+         << "  -j N        encode or decode blocks on N threads\n"
+         << "  -o FILE     output file for a single input, - for stdout\n"
+         << "  -f          overwrite existing output files\n"
+         << "  -r S:L      with -d, extract only L bytes starting at offset S\n"
+         << "With no FILE, or FILE -, reads stdin and writes stdout.\n"
+         << "Without any arguments the tool runs interactively." << endl;
+    exit(1);
+}
+
+Options parseArguments(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-" || arg[0] != '-') {
+            options.inputs.push_back(arg);
+            continue;
+        }
+        if (arg == "-c" || arg == "-d") {
+            options.mode = arg[1];
+        }
+        else if (arg == "-f") {
+            options.force = true;
+        }
+        else if (arg.size() == 2 && arg[1] >= '0' + minLevel && arg[1] <= '0' + maxLevel) {
+            options.pipeline.level = arg[1] - '0';
+        }
+        else if (i + 1 >= argc) {
+            usage();
+        }
+        else if (arg == "-p") {
+            if (!parsePipeline(argv[++i], options.pipeline)) {
+                cerr << "Error: Unknown pipeline " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (arg == "-j") {
+            options.threads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "-o") {
+            options.output = argv[++i];
+        }
+        else if (arg == "-r") {
+            string value = argv[++i];
+            size_t colon = value.find(':');
+            if (colon == string::npos) {
+                usage();
+            }
+            options.range = true;
+            options.rangeStart = stoull(value.substr(0, colon));
+            options.rangeLength = stoull(value.substr(colon + 1));
+        }
+        else {
+            usage();
+        }
+    }
+
+    if (options.mode == 0 || (options.range && options.mode != 'd')) {
+        usage();
+    }
+    if (options.inputs.empty()) {
+        options.inputs.push_back("-");
+    }
+    if (!options.output.empty() && options.inputs.size() > 1) {
+        cerr << "Error: -o can only be used with a single input" << endl;
+        exit(1);
+    }
+    return options;
+}
+
+bool endsWith(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+string outputName(const Options& options, const string& input) {
+    if (!options.output.empty()) {
+        return options.output;
+    }
+    if (input == "-") {
+        return "-";
+    }
+    if (options.mode == 'c') {
+        return input + compressedSuffix;
+    }
+    return endsWith(input, compressedSuffix) ? input.substr(0, input.size() - strlen(compressedSuffix)) : input + ".out";
+}
+
+// Compresses or decompresses one input; reports errors on cerr.
+bool processFile(const Options& options, const string& inputName) {
+    ifstream file;
+    if (inputName != "-") {
+        file.open(inputName, ios::binary);
+        if (!file) {
+            cerr << "Error: Could not open the file " << inputName << endl;
+            return false;
+        }
+    }
+    istream& input = inputName == "-" ? cin : file;
+    bool seekable = inputName != "-";
+
+    bool container = seekable && hasMagic(input);
+    bool legacy = options.mode == 'd' && seekable && !container && isLegacyCompressed(input);
+    if (options.mode == 'c' && container && !options.force) {
+        cerr << "Error: " << inputName << " is already compressed (use -f to compress it again)" << endl;
+        return false;
+    }
+    if (options.mode == 'd' && seekable && !container && !legacy) {
+        cerr << "Error: " << inputName << " is not compressed" << endl;
+        return false;
+    }
+    if (options.range && !seekable) {
+        cerr << "Error: -r needs a seekable input file" << endl;
+        return false;
+    }
+
+    string outputFile = outputName(options, inputName);
+    ofstream outFile;
+    if (outputFile != "-") {
+        if (!options.force && ifstream(outputFile)) {
+            cerr << "Error: " << outputFile << " already exists (use -f to overwrite it)" << endl;
+            return false;
+        }
+        outFile.open(outputFile, ios::binary);
+        if (!outFile) {
+            cerr << "Error: Could not write to the file " << outputFile << endl;
+            return false;
+        }
+    }
+    ostream& output = outputFile == "-" ? cout : outFile;
+
+    bool ok;
+    if (options.mode == 'c') {
+        ok = compressStream(input, output, options.threads, options.pipeline);
+    }
+    else if (options.range) {
+        ok = decompressRange(input, output, options.rangeStart, options.rangeLength);
+    }
+    else {
+        ok = legacy ? legacyDecode(input, &output) : decompressStream(input, output, options.threads);
+    }
+    output.flush();
+    if (!ok || !output) {
+        cerr << "Error: " << (options.mode == 'c' ? "compressing " : "decompressing ") << inputName << " failed"
+             << (output ? ": input is corrupt" : ": could not write output") << endl;
+        return false;
+    }
+    return true;
+}
+
+#ifndef RLE_NO_MAIN
+int main(int argc, char* argv[]) {
+    if (argc == 1) {
+        return interactive();
+    }
+
+    ios::sync_with_stdio(false);
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    Options options = parseArguments(argc, argv);
+    bool ok = true;
+    for (const string& input : options.inputs) {
+        ok = processFile(options, input) && ok;
+    }
+    return ok ? 0 : 1;
+}
+#endif
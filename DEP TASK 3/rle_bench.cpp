@@ -0,0 +1,327 @@
+#define RLE_NO_MAIN
+#include "ConsoleApplication1.cpp"
+
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compression benchmark for the codecs in ConsoleApplication1.cpp. Every
+// pipeline is run over a set of generated corpora and reported with its
+// compression ratio, encode and decode throughput and peak RSS. Each case
+// runs in a forked child so the peak RSS belongs to that case alone.
+//
+//   rle_bench --size 64 --threads 4 --corpus text --pipeline auto
+//       --pipeline bwt+mtf+rle+huff --json result.json
+
+struct BenchConfig {
+    size_t sizeMiB = 16;
+    size_t threads = 1;
+    int repeat = 1;
+    vector<string> corpora;
+    vector<string> pipelines;
+    string jsonPath;
+};
+
+struct CaseResult {
+    bool ok = false;
+    uint64_t rawSize = 0;
+    uint64_t compressedSize = 0;
+    double encodeSeconds = 0;
+    double decodeSeconds = 0;
+    long peakRssKiB = 0;
+};
+
+const char* const corpusNames[] = { "random", "text", "repetitive", "binary" };
+
+string makeCorpus(const string& name, size_t size) {
+    mt19937_64 rng(42);
+    string data;
+    data.reserve(size + 4096);
+    if (name == "random") {
+        while (data.size() < size) {
+            uint64_t value = rng();
+            data.append((const char*)&value, sizeof(value));
+        }
+    }
+    else if (name == "text") {
+        // Words drawn with a Zipf-like skew, so common words dominate the way
+        // they do in prose and source code.
+        static const char* const words[] = {
+            "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with", "was", "on", "be",
+            "at", "by", "this", "from", "or", "have", "an", "which", "file", "data", "block", "stream",
+            "contact", "weather", "forecast", "server", "request", "response", "compress", "buffer",
+        };
+        const size_t wordCount = sizeof(words) / sizeof(words[0]);
+        while (data.size() < size) {
+            size_t rank = (size_t)(wordCount * pow(uniform_real_distribution<double>(0, 1)(rng), 3));
+            data += words[min(rank, wordCount - 1)];
+            uint64_t roll = rng() % 16;
+            data += roll == 0 ? ".\n" : roll == 1 ? ", " : " ";
+        }
+    }
+    else if (name == "repetitive") {
+        // Long runs of a few values, like zero-padded records or sparse images.
+        while (data.size() < size) {
+            data.append(1 + rng() % 4096, "\0\xff ab"[rng() % 5]);
+        }
+    }
+    else {
+        // A table of fixed-size records: increasing ids, small counters, floats
+        // and zero padding.
+        uint32_t id = 1000;
+        while (data.size() < size) {
+            char record[32] = {};
+            id += 1 + rng() % 3;
+            uint16_t counter = (uint16_t)(rng() % 100);
+            float value = (float)(rng() % 10000) / 100.0f;
+            memcpy(record, &id, 4);
+            memcpy(record + 4, &counter, 2);
+            memcpy(record + 8, &value, 4);
+            data.append(record, sizeof(record));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// Reads straight from a string, so the benchmark measures the codecs rather
+// than stream copies.
+class MemoryInput : public streambuf {
+public:
+    MemoryInput(const string& data) {
+        char* begin = const_cast<char*>(data.data());
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+class MemoryOutput : public streambuf {
+public:
+    MemoryOutput(string& target) : target(target) {}
+
+protected:
+    int overflow(int ch) override {
+        if (ch != EOF) {
+            target += (char)ch;
+        }
+        return ch;
+    }
+
+    streamsize xsputn(const char* data, streamsize size) override {
+        target.append(data, size);
+        return size;
+    }
+
+private:
+    string& target;
+};
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs one corpus/pipeline pair in this process, keeping the fastest of
+// config.repeat runs in each direction.
+CaseResult runCase(const BenchConfig& config, const string& corpusName, const Pipeline& pipeline) {
+    CaseResult result;
+    string data = makeCorpus(corpusName, config.sizeMiB << 20);
+    string compressed;
+    string decompressed;
+    compressed.reserve(data.size() + data.size() / 64);
+    decompressed.reserve(data.size());
+    result.rawSize = data.size();
+    result.ok = true;
+
+    for (int i = 0; i < config.repeat; ++i) {
+        compressed.clear();
+        MemoryInput inBuf(data);
+        MemoryOutput outBuf(compressed);
+        istream in(&inBuf);
+        ostream out(&outBuf);
+        auto start = chrono::steady_clock::now();
+        result.ok = compressStream(in, out, config.threads, pipeline) && result.ok;
+        double seconds = secondsSince(start);
+        result.encodeSeconds = i == 0 ? seconds : min(result.encodeSeconds, seconds);
+    }
+    for (int i = 0; i < config.repeat; ++i) {
+        decompressed.clear();
+        MemoryInput inBuf(compressed);
+        MemoryOutput outBuf(decompressed);
+        istream in(&inBuf);
+        ostream out(&outBuf);
+        auto start = chrono::steady_clock::now();
+        result.ok = decompressStream(in, out, config.threads) && result.ok;
+        double seconds = secondsSince(start);
+        result.decodeSeconds = i == 0 ? seconds : min(result.decodeSeconds, seconds);
+    }
+    result.compressedSize = compressed.size();
+    result.ok = result.ok && decompressed == data;
+    return result;
+}
+
+CaseResult runIsolated(const BenchConfig& config, const string& corpusName, const Pipeline& pipeline) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        CaseResult result = runCase(config, corpusName, pipeline);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    CaseResult result;
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    if (got != (ssize_t)sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return CaseResult();
+    }
+    result.peakRssKiB = usage.ru_maxrss;
+    return result;
+}
+
+void benchUsage() {
+    cerr << "Usage: rle_bench [--size MIB] [--threads N] [--repeat N] [--corpus NAME]...\n"
+         << "                 [--pipeline PIPELINE|auto]... [--json FILE|-]\n"
+         << "Corpora: random, text, repetitive, binary (default: all).\n"
+         << "Pipelines default to every auto candidate plus auto." << endl;
+    exit(1);
+}
+
+BenchConfig parseBenchArguments(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            benchUsage();
+        }
+        string value = argv[++i];
+        if (arg == "--size") {
+            config.sizeMiB = max(1, stoi(value));
+        }
+        else if (arg == "--threads") {
+            config.threads = max(1, stoi(value));
+        }
+        else if (arg == "--repeat") {
+            config.repeat = max(1, stoi(value));
+        }
+        else if (arg == "--corpus") {
+            if (find(begin(corpusNames), end(corpusNames), value) == end(corpusNames)) {
+                benchUsage();
+            }
+            config.corpora.push_back(value);
+        }
+        else if (arg == "--pipeline") {
+            Pipeline pipeline;
+            if (!parsePipeline(value, pipeline)) {
+                cerr << "Error: Unknown pipeline " << value << endl;
+                exit(1);
+            }
+            config.pipelines.push_back(value);
+        }
+        else if (arg == "--json") {
+            config.jsonPath = value;
+        }
+        else {
+            benchUsage();
+        }
+    }
+
+    if (config.corpora.empty()) {
+        config.corpora.assign(begin(corpusNames), end(corpusNames));
+    }
+    if (config.pipelines.empty()) {
+        for (const AutoCandidate& candidate : autoPipelines) {
+            config.pipelines.push_back(candidate.spec);
+        }
+        config.pipelines.push_back("auto");
+    }
+    return config;
+}
+
+struct Row {
+    string corpus;
+    string pipeline;
+    CaseResult result;
+};
+
+string toJson(const BenchConfig& config, const vector<Row>& rows) {
+    ostringstream json;
+    json << "{\n"
+         << "  \"kernels\": \"" << kernels().name << "\",\n"
+         << "  \"threads\": " << config.threads << ",\n"
+         << "  \"size_bytes\": " << (config.sizeMiB << 20) << ",\n"
+         << "  \"results\": [";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const CaseResult& r = rows[i].result;
+        json << (i ? "," : "") << "\n    { \"corpus\": \"" << rows[i].corpus << "\", \"pipeline\": \"" << rows[i].pipeline
+             << "\", \"ok\": " << (r.ok ? "true" : "false")
+             << ", \"compressed_bytes\": " << r.compressedSize
+             << ", \"ratio\": " << (r.rawSize ? (double)r.compressedSize / r.rawSize : 0)
+             << ", \"encode_mb_per_s\": " << (r.encodeSeconds > 0 ? r.rawSize / r.encodeSeconds / 1e6 : 0)
+             << ", \"decode_mb_per_s\": " << (r.decodeSeconds > 0 ? r.rawSize / r.decodeSeconds / 1e6 : 0)
+             << ", \"peak_rss_kib\": " << r.peakRssKiB << " }";
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config = parseBenchArguments(argc, argv);
+
+    cout << "Kernels: " << kernels().name << ", threads: " << config.threads << ", corpus size: " << config.sizeMiB
+         << " MiB" << endl;
+    printf("%-11s %-18s %7s %12s %12s %13s\n", "corpus", "pipeline", "ratio", "encode MB/s", "decode MB/s",
+        "peak RSS MiB");
+    fflush(stdout);
+
+    vector<Row> rows;
+    bool allOk = true;
+    for (const string& corpus : config.corpora) {
+        for (const string& spec : config.pipelines) {
+            Pipeline pipeline;
+            parsePipeline(spec, pipeline);
+            CaseResult result = runIsolated(config, corpus, pipeline);
+            rows.push_back({ corpus, spec, result });
+            allOk = allOk && result.ok;
+            if (!result.ok) {
+                printf("%-11s %-18s FAILED\n", corpus.c_str(), spec.c_str());
+            }
+            else {
+                printf("%-11s %-18s %7.3f %12.1f %12.1f %13.1f\n", corpus.c_str(), spec.c_str(),
+                    (double)result.compressedSize / result.rawSize, result.rawSize / result.encodeSeconds / 1e6,
+                    result.rawSize / result.decodeSeconds / 1e6, result.peakRssKiB / 1024.0);
+            }
+            fflush(stdout);
+        }
+    }
+
+    if (!config.jsonPath.empty()) {
+        string json = toJson(config, rows);
+        if (config.jsonPath == "-") {
+            cout << json;
+        }
+        else {
+            ofstream file(config.jsonPath);
+            if (!file) {
+                cerr << "Error: Could not write to the file " << config.jsonPath << endl;
+                return 1;
+            }
+            file << json;
+        }
+    }
+    return allOk ? 0 : 1;
+}
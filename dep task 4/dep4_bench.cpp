@@ -0,0 +1,575 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace std;
+
+// Load generator for the TcpServer in dep4.cpp. It keeps N connections busy
+// against a local instance with a weighted mix of GETs, then reports
+// throughput and latency percentiles as text and, optionally, JSON.
+//
+//   dep4_bench --connections 256 --threads 4 --duration 10
+//       --path /index.html:70 --path /big.bin:10 --path /missing.html:20
+//       --close-ratio 0.1 --json result.json
+
+// Log-linear histogram in the style of HdrHistogram: values below 128 get
+// their own bucket, larger ones are bucketed by their highest set bit and the
+// six bits below it, so every latency keeps better than 2% relative precision.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(bucketCount, 0) {}
+
+    void record(uint64_t nanoseconds) {
+        counts[bucketIndex(nanoseconds)]++;
+        total++;
+        maxValue = std::max(maxValue, nanoseconds);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return maxValue;
+    }
+
+    uint64_t percentile(double p) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(bucketUpperBound(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+private:
+    static const size_t linearCount = 128;
+    static const size_t subBucketCount = 64;
+    static const size_t bucketCount = linearCount + 58 * subBucketCount;
+
+    static size_t bucketIndex(uint64_t value) {
+        if (value < linearCount) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - 6;
+        uint64_t mantissa = value >> shift;
+        return linearCount + (shift - 1) * subBucketCount + (mantissa - subBucketCount);
+    }
+
+    static uint64_t bucketUpperBound(size_t index) {
+        if (index < linearCount) {
+            return index;
+        }
+        int shift = (index - linearCount) / subBucketCount + 1;
+        uint64_t mantissa = (index - linearCount) % subBucketCount + subBucketCount;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+};
+
+struct Target {
+    string path;
+    int weight;
+};
+
+struct BenchConfig {
+    string host = "127.0.0.1";
+    int port = 8080;
+    int connections = 64;
+    int threads = 1;
+    double durationSeconds = 10;
+    double warmupSeconds = 1;
+    double closeRatio = 0;
+    vector<Target> targets;
+    string jsonPath;
+};
+
+struct BenchResult {
+    LatencyHistogram latency;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t connects = 0;
+    uint64_t statusClasses[6] = {};
+    vector<uint64_t> perTarget;
+
+    void merge(const BenchResult& other) {
+        latency.merge(other.latency);
+        requests += other.requests;
+        bytes += other.bytes;
+        errors += other.errors;
+        connects += other.connects;
+        for (int i = 0; i < 6; ++i) {
+            statusClasses[i] += other.statusClasses[i];
+        }
+        perTarget.resize(max(perTarget.size(), other.perTarget.size()));
+        for (size_t i = 0; i < other.perTarget.size(); ++i) {
+            perTarget[i] += other.perTarget[i];
+        }
+    }
+};
+
+// How long a client whose socket could not be opened waits before retrying.
+const int retryDelayMs = 10;
+
+// One thread's share of the connections, driven by a level-triggered epoll
+// loop. Every connection always has exactly one request outstanding.
+class LoadWorker {
+public:
+    LoadWorker(const BenchConfig& config, int connectionCount, unsigned seed)
+        : config(config), connectionCount(connectionCount), random(seed) {
+        totalWeight = 0;
+        for (const auto& target : config.targets) {
+            totalWeight += target.weight;
+        }
+        result.perTarget.assign(config.targets.size(), 0);
+    }
+
+    void run(chrono::steady_clock::time_point measureFrom, chrono::steady_clock::time_point stopAt) {
+        this->measureFrom = measureFrom;
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            cerr << "Error creating epoll instance" << endl;
+            exit(1);
+        }
+        clients.resize(connectionCount);
+        for (auto& client : clients) {
+            startRequest(client);
+        }
+
+        struct epoll_event events[256];
+        while (chrono::steady_clock::now() < stopAt) {
+            int n = epoll_wait(epollFd, events, 256, retries.empty() ? 100 : retryDelayMs);
+            for (int i = 0; i < n; ++i) {
+                Client& client = clients[events[i].data.u32];
+                if (events[i].events & (EPOLLERR | EPOLLHUP) && client.state != Client::Reading) {
+                    fail(client);
+                    continue;
+                }
+                if (client.state == Client::Connecting) {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    if (error != 0) {
+                        fail(client);
+                        continue;
+                    }
+                    client.state = Client::Sending;
+                }
+                if (client.state == Client::Sending) {
+                    sendRequest(client);
+                }
+                else if (client.state == Client::Reading) {
+                    readResponse(client);
+                }
+            }
+
+            // Connections that could not even be opened try again here, after
+            // a short wait, instead of dropping out of the run.
+            if (!retries.empty()) {
+                auto retryBefore = chrono::steady_clock::now() - chrono::milliseconds(retryDelayMs);
+                vector<uint32_t> waiting;
+                waiting.swap(retries);
+                for (uint32_t index : waiting) {
+                    if (clients[index].startedAt <= retryBefore) {
+                        startRequest(clients[index]);
+                    }
+                    else {
+                        retries.push_back(index);
+                    }
+                }
+            }
+        }
+
+        for (auto& client : clients) {
+            if (client.fd >= 0) {
+                close(client.fd);
+            }
+        }
+        close(epollFd);
+    }
+
+    const BenchResult& results() const {
+        return result;
+    }
+
+private:
+    struct Client {
+        enum State { Connecting, Sending, Reading };
+
+        int fd = -1;
+        State state = Connecting;
+        string request;
+        size_t sent = 0;
+        string response;
+        size_t headerLength = 0;
+        size_t contentLength = 0;
+        size_t bytes = 0;
+        int status = 0;
+        bool keepAlive = true;
+        size_t target = 0;
+        chrono::steady_clock::time_point startedAt;
+    };
+
+    size_t pickTarget() {
+        int roll = uniform_int_distribution<int>(0, totalWeight - 1)(random);
+        for (size_t i = 0; i < config.targets.size(); ++i) {
+            roll -= config.targets[i].weight;
+            if (roll < 0) {
+                return i;
+            }
+        }
+        return config.targets.size() - 1;
+    }
+
+    // Picks the next request and, if the connection was closed, opens a new
+    // one; for fresh connections the latency includes the TCP handshake. If
+    // the socket cannot be opened at all the client is queued for a retry.
+    void startRequest(Client& client) {
+        client.target = pickTarget();
+        client.keepAlive = uniform_real_distribution<double>(0, 1)(random) >= config.closeRatio;
+        client.request = "GET " + config.targets[client.target].path + " HTTP/1.1\r\nHost: " + config.host
+            + (client.keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        client.sent = 0;
+        client.response.clear();
+        client.headerLength = 0;
+        client.contentLength = 0;
+        client.bytes = 0;
+        client.status = 0;
+        client.startedAt = chrono::steady_clock::now();
+
+        uint32_t index = &client - clients.data();
+        if (client.fd >= 0) {
+            client.state = Client::Sending;
+            watch(client, EPOLLOUT, EPOLL_CTL_MOD, index);
+            return;
+        }
+
+        client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (client.fd < 0) {
+            countError(client);
+            retries.push_back(index);
+            return;
+        }
+        int enable = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(config.port);
+        inet_pton(AF_INET, config.host.c_str(), &address.sin_addr);
+        result.connects++;
+        if (connect(client.fd, (struct sockaddr*)&address, sizeof(address)) < 0 && errno != EINPROGRESS) {
+            close(client.fd);
+            client.fd = -1;
+            countError(client);
+            retries.push_back(index);
+            return;
+        }
+        client.state = Client::Connecting;
+        watch(client, EPOLLOUT, EPOLL_CTL_ADD, index);
+    }
+
+    void watch(Client& client, uint32_t events, int operation, uint32_t index) {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.u32 = index;
+        epoll_ctl(epollFd, operation, client.fd, &ev);
+    }
+
+    void sendRequest(Client& client) {
+        while (client.sent < client.request.size()) {
+            ssize_t written = send(client.fd, client.request.data() + client.sent, client.request.size() - client.sent, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                fail(client);
+                return;
+            }
+            client.sent += written;
+        }
+        client.state = Client::Reading;
+        watch(client, EPOLLIN, EPOLL_CTL_MOD, &client - clients.data());
+    }
+
+    void readResponse(Client& client) {
+        char buffer[65536];
+        while (true) {
+            ssize_t got = read(client.fd, buffer, sizeof(buffer));
+            if (got < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                fail(client);
+                return;
+            }
+            if (got == 0) {
+                fail(client);
+                return;
+            }
+
+            // Only the head is kept; body bytes are just counted.
+            if (client.headerLength == 0) {
+                client.response.append(buffer, got);
+                size_t end = client.response.find("\r\n\r\n");
+                if (end == string::npos) {
+                    continue;
+                }
+                client.headerLength = end + 4;
+                parseHead(client);
+                client.bytes = client.response.size() - client.headerLength;
+            }
+            else {
+                client.bytes += got;
+            }
+
+            if (client.bytes >= client.contentLength) {
+                finish(client);
+                return;
+            }
+        }
+    }
+
+    void parseHead(Client& client) {
+        string head = client.response.substr(0, client.headerLength);
+        transform(head.begin(), head.end(), head.begin(), ::tolower);
+        client.status = atoi(head.c_str() + 9);
+        size_t pos = head.find("\r\ncontent-length:");
+        client.contentLength = pos == string::npos ? 0 : strtoull(head.c_str() + pos + 17, nullptr, 10);
+        if (head.find("\r\nconnection: close") != string::npos) {
+            client.keepAlive = false;
+        }
+    }
+
+    void finish(Client& client) {
+        auto now = chrono::steady_clock::now();
+        if (client.startedAt >= measureFrom) {
+            result.latency.record(chrono::duration_cast<chrono::nanoseconds>(now - client.startedAt).count());
+            result.requests++;
+            result.bytes += client.headerLength + client.contentLength;
+            result.statusClasses[min(client.status / 100, 5)]++;
+            result.perTarget[client.target]++;
+        }
+        if (!client.keepAlive) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+            close(client.fd);
+            client.fd = -1;
+        }
+        startRequest(client);
+    }
+
+    // Errors, like latency samples, only count once the warmup is over.
+    void countError(const Client& client) {
+        if (client.startedAt >= measureFrom) {
+            result.errors++;
+        }
+    }
+
+    void fail(Client& client) {
+        countError(client);
+        if (client.fd >= 0) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+            close(client.fd);
+            client.fd = -1;
+        }
+        startRequest(client);
+    }
+
+    const BenchConfig& config;
+    int connectionCount;
+    int totalWeight;
+    mt19937 random;
+    int epollFd = -1;
+    chrono::steady_clock::time_point measureFrom;
+    vector<Client> clients;
+    vector<uint32_t> retries;
+    BenchResult result;
+};
+
+void usage() {
+    cerr << "Usage: dep4_bench [--host ADDR] [--port N] [--connections N] [--threads N]\n"
+         << "                  [--duration SECONDS] [--warmup SECONDS] [--close-ratio R]\n"
+         << "                  [--path PATH[:WEIGHT]]... [--json FILE|-]" << endl;
+    exit(1);
+}
+
+BenchConfig parseArguments(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+        }
+        string value = argv[++i];
+        if (arg == "--host") {
+            config.host = value;
+        }
+        else if (arg == "--port") {
+            config.port = stoi(value);
+        }
+        else if (arg == "--connections") {
+            config.connections = stoi(value);
+        }
+        else if (arg == "--threads") {
+            config.threads = stoi(value);
+        }
+        else if (arg == "--duration") {
+            config.durationSeconds = stod(value);
+        }
+        else if (arg == "--warmup") {
+            config.warmupSeconds = stod(value);
+        }
+        else if (arg == "--close-ratio") {
+            config.closeRatio = stod(value);
+        }
+        else if (arg == "--path") {
+            size_t colon = value.rfind(':');
+            if (colon == string::npos) {
+                config.targets.push_back({ value, 1 });
+            }
+            else {
+                config.targets.push_back({ value.substr(0, colon), stoi(value.substr(colon + 1)) });
+            }
+        }
+        else if (arg == "--json") {
+            config.jsonPath = value;
+        }
+        else {
+            usage();
+        }
+    }
+
+    if (config.targets.empty()) {
+        config.targets.push_back({ "/index.html", 1 });
+    }
+    config.threads = max(1, min(config.threads, config.connections));
+    return config;
+}
+
+string jsonEscape(const string& text) {
+    string escaped;
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') {
+            escaped += '\\';
+        }
+        escaped += ch;
+    }
+    return escaped;
+}
+
+string toJson(const BenchConfig& config, const BenchResult& result, double seconds) {
+    ostringstream json;
+    json << "{\n"
+         << "  \"host\": \"" << jsonEscape(config.host) << "\",\n"
+         << "  \"port\": " << config.port << ",\n"
+         << "  \"connections\": " << config.connections << ",\n"
+         << "  \"threads\": " << config.threads << ",\n"
+         << "  \"duration_s\": " << seconds << ",\n"
+         << "  \"close_ratio\": " << config.closeRatio << ",\n"
+         << "  \"requests\": " << result.requests << ",\n"
+         << "  \"requests_per_s\": " << result.requests / seconds << ",\n"
+         << "  \"bytes_per_s\": " << result.bytes / seconds << ",\n"
+         << "  \"errors\": " << result.errors << ",\n"
+         << "  \"connects\": " << result.connects << ",\n"
+         << "  \"status\": { \"2xx\": " << result.statusClasses[2] << ", \"3xx\": " << result.statusClasses[3]
+         << ", \"4xx\": " << result.statusClasses[4] << ", \"5xx\": " << result.statusClasses[5] << " },\n"
+         << "  \"latency_us\": { \"p50\": " << result.latency.percentile(50) / 1000.0
+         << ", \"p90\": " << result.latency.percentile(90) / 1000.0
+         << ", \"p99\": " << result.latency.percentile(99) / 1000.0
+         << ", \"p99_9\": " << result.latency.percentile(99.9) / 1000.0
+         << ", \"max\": " << result.latency.max() / 1000.0 << " },\n"
+         << "  \"targets\": [";
+    for (size_t i = 0; i < config.targets.size(); ++i) {
+        json << (i ? ", " : "") << "{ \"path\": \"" << jsonEscape(config.targets[i].path) << "\", \"weight\": "
+             << config.targets[i].weight << ", \"requests\": " << result.perTarget[i] << " }";
+    }
+    json << "]\n}\n";
+    return json.str();
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config = parseArguments(argc, argv);
+
+    auto start = chrono::steady_clock::now();
+    auto measureFrom = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(config.warmupSeconds));
+    auto stopAt = measureFrom + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(config.durationSeconds));
+
+    vector<unique_ptr<LoadWorker>> workers;
+    for (int i = 0; i < config.threads; ++i) {
+        int share = config.connections / config.threads + (i < config.connections % config.threads ? 1 : 0);
+        workers.push_back(make_unique<LoadWorker>(config, share, 12345 + i));
+    }
+    vector<thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(&LoadWorker::run, worker.get(), measureFrom, stopAt);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    BenchResult total;
+    for (auto& worker : workers) {
+        total.merge(worker->results());
+    }
+    double seconds = config.durationSeconds;
+
+    cout << "Requests:     " << total.requests << " (" << total.requests / seconds << " req/s)" << endl;
+    cout << "Transfer:     " << total.bytes / seconds / (1 << 20) << " MiB/s" << endl;
+    cout << "Errors:       " << total.errors << ", connects: " << total.connects << endl;
+    cout << "Status:       2xx " << total.statusClasses[2] << ", 3xx " << total.statusClasses[3] << ", 4xx "
+         << total.statusClasses[4] << ", 5xx " << total.statusClasses[5] << endl;
+    cout << "Latency (us): p50 " << total.latency.percentile(50) / 1000.0 << ", p99 " << total.latency.percentile(99) / 1000.0
+         << ", p99.9 " << total.latency.percentile(99.9) / 1000.0 << ", max " << total.latency.max() / 1000.0 << endl;
+
+    if (!config.jsonPath.empty()) {
+        string json = toJson(config, total, seconds);
+        if (config.jsonPath == "-") {
+            cout << json;
+        }
+        else {
+            ofstream file(config.jsonPath);
+            if (!file) {
+                cerr << "Error: Could not write to the file " << config.jsonPath << endl;
+                return 1;
+            }
+            file << json;
+        }
+    }
+    return 0;
+}
@@ -3,6 +3,33 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <queue>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <charconv>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <nlohmann/json.hpp>
 #include <curl/curl.h> // For making HTTP requests
 
@@ -15,68 +42,1745 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
     return size * nmemb;
 }
 
+// Base URL of an API, overridable through an environment variable so the
+// client can be pointed at a mirror or a local mock server.
+string apiUrl(const char* variable, const string& defaultUrl) {
+    const char* value = getenv(variable);
+    return value && *value ? value : defaultUrl;
+}
+
+// Receives a response body as curl delivers it, instead of having it
+// buffered in FetchResult::body. reset() is called before every attempt.
+class ResponseSink {
+public:
+    virtual ~ResponseSink() {}
+    virtual void reset() = 0;
+    virtual void write(const char* data, size_t size) = 0;
+};
+
+size_t SinkCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    ((ResponseSink*)userp)->write((const char*)contents, size * nmemb);
+    return size * nmemb;
+}
+
+// Result of one request made through FetchEngine
+struct FetchResult {
+    long status = 0;    // HTTP status, 0 if no response arrived
+    string body;
+    string error;       // empty on success
+
+    bool ok() const { return error.empty(); }
+};
+
+// Define the FetchEngine class
+// Runs HTTP requests concurrently on one curl multi handle. Connections and
+// TLS sessions are kept in the multi handle's pool between batches, and
+// requests to the same host are multiplexed as HTTP/2 streams over one
+// connection when the server supports it. Failed requests (transport
+// errors, 429 and 5xx) are retried with exponential backoff and jitter, or
+// after the server's Retry-After delay.
+class FetchEngine {
+private:
+    typedef chrono::steady_clock Clock;
+    typedef pair<Clock::time_point, size_t> Retry;    // due time, request index
+
+    CURLM* multi;
+    vector<CURL*> idleHandles;
+    size_t maxConcurrent;
+    int maxRetries;
+    long backoffMs;
+    long timeoutMs;
+    mt19937 jitter;
+
+    CURL* acquireHandle() {
+        if (!idleHandles.empty()) {
+            CURL* handle = idleHandles.back();
+            idleHandles.pop_back();
+            return handle;
+        }
+        CURL* handle = curl_easy_init();
+        if (handle) {
+            curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+            curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+            curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, min(timeoutMs, 10000L));
+            curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeoutMs);
+        }
+        return handle;
+    }
+
+    static bool retryable(CURLcode code, long status) {
+        if (code == CURLE_OK) {
+            return status == 429 || status >= 500;
+        }
+        return code != CURLE_URL_MALFORMAT && code != CURLE_UNSUPPORTED_PROTOCOL && code != CURLE_OUT_OF_MEMORY;
+    }
+
+    // Delay before retry number attempt (0-based): a random point in
+    // [cap / 2, cap] with cap = backoffMs * 2^attempt (the exponent capped
+    // at 10), so clients that failed together do not all come back at the
+    // same moment. A Retry-After header, up to 60 s, takes precedence.
+    long backoff(int attempt, CURL* handle) {
+        curl_off_t retryAfter = 0;
+        if (curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0) {
+            return (long)min<curl_off_t>(retryAfter, 60) * 1000;
+        }
+        long cap = backoffMs << min(attempt, 10);
+        return uniform_int_distribution<long>(cap / 2, cap)(jitter);
+    }
+
+    // curl_global_init and curl_global_cleanup are not thread-safe on every
+    // libcurl build, so they run once per process: on first use, and at
+    // exit once every engine is gone.
+    struct CurlGlobal {
+        CurlGlobal() {
+            curl_global_init(CURL_GLOBAL_DEFAULT);
+        }
+
+        ~CurlGlobal() {
+            curl_global_cleanup();
+        }
+    };
+
+public:
+    FetchEngine(size_t maxConcurrent = 32, int maxRetries = 3, long backoffMs = 200, long timeoutMs = 30000)
+        : maxConcurrent(max<size_t>(1, maxConcurrent)), maxRetries(maxRetries), backoffMs(backoffMs),
+          timeoutMs(timeoutMs), jitter(random_device()()) {
+        static CurlGlobal global;
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)this->maxConcurrent);
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)this->maxConcurrent);
+    }
+
+    ~FetchEngine() {
+        for (CURL* handle : idleHandles) {
+            curl_easy_cleanup(handle);
+        }
+        curl_multi_cleanup(multi);
+    }
+
+    FetchEngine(const FetchEngine&) = delete;
+    FetchEngine& operator=(const FetchEngine&) = delete;
+
+    // Fetches every URL, at most maxConcurrent at a time, and returns the
+    // results in the same order. A non-null sinks[i] receives the body of
+    // urls[i] as it arrives, and results[i].body stays empty.
+    vector<FetchResult> fetchAll(const vector<string>& urls, const vector<ResponseSink*>& sinks = {}) {
+        vector<FetchResult> results(urls.size());
+        vector<int> attempts(urls.size(), 0);
+        deque<size_t> ready;
+        priority_queue<Retry, vector<Retry>, greater<Retry>> retries;
+        size_t running = 0;
+        for (size_t i = 0; i < urls.size(); ++i) {
+            ready.push_back(i);
+        }
+
+        while (!ready.empty() || !retries.empty() || running > 0) {
+            Clock::time_point now = Clock::now();
+            while (!retries.empty() && retries.top().first <= now) {
+                ready.push_front(retries.top().second);
+                retries.pop();
+            }
+            while (!ready.empty() && running < maxConcurrent) {
+                size_t index = ready.front();
+                ready.pop_front();
+                CURL* handle = acquireHandle();
+                if (!handle) {
+                    results[index].error = "could not create a curl handle";
+                    continue;
+                }
+                ResponseSink* sink = index < sinks.size() ? sinks[index] : nullptr;
+                if (sink) {
+                    sink->reset();
+                    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, SinkCallback);
+                    curl_easy_setopt(handle, CURLOPT_WRITEDATA, sink);
+                }
+                else {
+                    results[index].body.clear();
+                    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, WriteCallback);
+                    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &results[index].body);
+                }
+                curl_easy_setopt(handle, CURLOPT_URL, urls[index].c_str());
+                curl_easy_setopt(handle, CURLOPT_PRIVATE, (void*)(uintptr_t)index);
+                curl_multi_add_handle(multi, handle);
+                ++running;
+            }
+
+            int stillRunning;
+            curl_multi_perform(multi, &stillRunning);
+
+            int queued;
+            while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+                if (message->msg != CURLMSG_DONE) {
+                    continue;
+                }
+                CURL* handle = message->easy_handle;
+                CURLcode code = message->data.result;
+                char* data;
+                long status = 0;
+                curl_easy_getinfo(handle, CURLINFO_PRIVATE, &data);
+                curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+                size_t index = (uintptr_t)data;
+                FetchResult& result = results[index];
+                result.status = status;
+                result.error = code != CURLE_OK ? curl_easy_strerror(code)
+                             : status >= 400 ? "HTTP status " + to_string(status) : "";
+                if (!result.ok() && retryable(code, status) && attempts[index] < maxRetries) {
+                    long delay = backoff(attempts[index]++, handle);
+                    retries.push(Retry(Clock::now() + chrono::milliseconds(delay), index));
+                }
+                curl_multi_remove_handle(multi, handle);
+                idleHandles.push_back(handle);
+                --running;
+            }
+
+            if (running > 0 || !retries.empty()) {
+                long waitMs = 1000;
+                if (!retries.empty()) {
+                    auto due = chrono::duration_cast<chrono::milliseconds>(retries.top().first - Clock::now());
+                    waitMs = max(0L, min(waitMs, (long)due.count()));
+                }
+                if (ready.empty() || running >= maxConcurrent) {
+                    curl_multi_poll(multi, nullptr, 0, (int)waitMs, nullptr);
+                }
+            }
+        }
+        return results;
+    }
+
+    FetchResult fetch(const string& url) {
+        return fetchAll({ url })[0];
+    }
+};
+
+// Parses a response body, reporting failures as "Error fetching <what>".
+// Returns null JSON on failure.
+json parseResponse(const FetchResult& result, const string& what) {
+    if (!result.ok()) {
+        cerr << "Error fetching " << what << ": " << result.error << endl;
+        return json();
+    }
+    json data = json::parse(result.body, nullptr, false);
+    if (data.is_discarded()) {
+        cerr << "Error fetching " << what << ": response is not valid JSON" << endl;
+        return json();
+    }
+    return data;
+}
+
 // Define the Location class
 class Location {
 public:
-    string name;
-    double latitude;
-    double longitude;
+    string name;
+    double latitude;
+    double longitude;
+
+    Location(string name, double lat, double lon) : name(name), latitude(lat), longitude(lon) {}
+};
+
+// Define the LocationManager class
+// Tracks locations by name, with a k-d tree over their positions as points
+// on the unit sphere for nearest and radius queries; straight-line distance
+// there orders locations like great-circle distance, with no special cases
+// at the poles or the date line. Additions go to a pending list and
+// removals leave tombstones; the tree is rebuilt on the next query once
+// they add up to an eighth of it.
+const double earthRadiusKm = 6371.0;
+const double modelGridDegrees = 0.1;    // cell size used to share one fetch between nearby locations
+
+// The centre of the grid cell the location falls in, with longitudes
+// wrapped so that -180 and 180 are one cell. Bulk refreshes and exports
+// fetch one forecast per cell and use it for every location in it. That
+// is an approximation: a location can be up to about 7 km from the centre,
+// which models finer than the cell and Open-Meteo's elevation downscaling
+// both resolve, so single lookups use the location itself.
+Location modelCell(const Location& location, double resolution = modelGridDegrees) {
+    int64_t columns = llround(360 / resolution);
+    int64_t column = (llround(location.longitude / resolution) % columns + columns) % columns;
+    if (2 * column > columns) {
+        column -= columns;
+    }
+    double latitude = llround(location.latitude / resolution) * resolution;
+    double longitude = column * resolution;
+    char name[64];
+    snprintf(name, sizeof(name), "cell(%.4f,%.4f)", latitude, longitude);
+    return Location(name, latitude, longitude);
+}
+
+// Locations that fall in one model grid cell, and the cell centre to fetch
+// for all of them.
+struct LocationGroup {
+    Location cell;
+    vector<Location> members;
+};
+
+class LocationManager {
+private:
+    struct Point {
+        double coordinate[3];
+    };
+
+    vector<Location> locations;
+    vector<Point> points;
+    vector<bool> live;
+    unordered_map<string, size_t> byName;
+    vector<size_t> tree;        // implicit k-d tree: the middle of each range is its node
+    vector<size_t> pending;     // added since the tree was built
+    size_t removedFromTree = 0;
+
+    static Point toPoint(double latitude, double longitude) {
+        double lat = latitude * M_PI / 180, lon = longitude * M_PI / 180;
+        return Point{ { cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat) } };
+    }
+
+    static double squaredChord(const Point& a, const Point& b) {
+        double sum = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            double d = a.coordinate[axis] - b.coordinate[axis];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    static double chordToKm(double squared) {
+        return 2 * earthRadiusKm * asin(min(1.0, sqrt(squared) / 2));
+    }
+
+    void build(size_t begin, size_t end, int axis) {
+        if (end - begin < 2) {
+            return;
+        }
+        size_t middle = begin + (end - begin) / 2;
+        nth_element(tree.begin() + begin, tree.begin() + middle, tree.begin() + end,
+            [&](size_t a, size_t b) { return points[a].coordinate[axis] < points[b].coordinate[axis]; });
+        build(begin, middle, (axis + 1) % 3);
+        build(middle + 1, end, (axis + 1) % 3);
+    }
+
+    // Drops removed locations and rebuilds the tree over the rest once the
+    // pending changes are large enough to slow queries down.
+    void refreshIndex() {
+        if (pending.size() + removedFromTree <= max<size_t>(64, tree.size() / 8)) {
+            return;
+        }
+        vector<Location> kept;
+        vector<Point> keptPoints;
+        byName.clear();
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (live[i]) {
+                byName[locations[i].name] = kept.size();
+                kept.push_back(locations[i]);
+                keptPoints.push_back(points[i]);
+            }
+        }
+        locations.swap(kept);
+        points.swap(keptPoints);
+        live.assign(locations.size(), true);
+        tree.resize(locations.size());
+        for (size_t i = 0; i < tree.size(); ++i) {
+            tree[i] = i;
+        }
+        build(0, tree.size(), 0);
+        pending.clear();
+        removedFromTree = 0;
+    }
+
+    void nearest(size_t begin, size_t end, int axis, const Point& target, size_t& best, double& bestDistance) const {
+        if (begin >= end) {
+            return;
+        }
+        size_t middle = begin + (end - begin) / 2;
+        size_t node = tree[middle];
+        if (live[node]) {
+            double distance = squaredChord(points[node], target);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = node;
+            }
+        }
+        double offset = target.coordinate[axis] - points[node].coordinate[axis];
+        int next = (axis + 1) % 3;
+        if (offset < 0) {
+            nearest(begin, middle, next, target, best, bestDistance);
+            if (offset * offset < bestDistance) {
+                nearest(middle + 1, end, next, target, best, bestDistance);
+            }
+        }
+        else {
+            nearest(middle + 1, end, next, target, best, bestDistance);
+            if (offset * offset < bestDistance) {
+                nearest(begin, middle, next, target, best, bestDistance);
+            }
+        }
+    }
+
+    void within(size_t begin, size_t end, int axis, const Point& target, double limit, vector<pair<double, size_t>>& found) const {
+        if (begin >= end) {
+            return;
+        }
+        size_t middle = begin + (end - begin) / 2;
+        size_t node = tree[middle];
+        double distance = squaredChord(points[node], target);
+        if (live[node] && distance <= limit) {
+            found.emplace_back(distance, node);
+        }
+        double offset = target.coordinate[axis] - points[node].coordinate[axis];
+        int next = (axis + 1) % 3;
+        if (offset <= 0 || offset * offset <= limit) {
+            within(begin, middle, next, target, limit, found);
+        }
+        if (offset >= 0 || offset * offset <= limit) {
+            within(middle + 1, end, next, target, limit, found);
+        }
+    }
+
+public:
+    // Returns false if a location with that name already exists.
+    bool addLocation(const Location& location) {
+        if (byName.count(location.name)) {
+            cout << "Location " << location.name << " already exists." << endl;
+            return false;
+        }
+        byName[location.name] = locations.size();
+        pending.push_back(locations.size());
+        locations.push_back(location);
+        points.push_back(toPoint(location.latitude, location.longitude));
+        live.push_back(true);
+        return true;
+    }
+
+    bool removeLocation(const string& name) {
+        auto found = byName.find(name);
+        if (found == byName.end()) {
+            cout << "Location not found." << endl;
+            return false;
+        }
+        live[found->second] = false;
+        auto added = find(pending.begin(), pending.end(), found->second);
+        if (added != pending.end()) {
+            pending.erase(added);
+        }
+        else {
+            ++removedFromTree;
+        }
+        byName.erase(found);
+        return true;
+    }
+
+    // The pointer stays valid until the next change or spatial query.
+    Location* findLocation(const string& name) {
+        auto found = byName.find(name);
+        return found == byName.end() ? nullptr : &locations[found->second];
+    }
+
+    size_t size() const {
+        return byName.size();
+    }
+
+    void listLocations() const {
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (live[i]) {
+                cout << locations[i].name << " (" << locations[i].latitude << ", " << locations[i].longitude << ")" << endl;
+            }
+        }
+    }
+
+    vector<Location> allLocations() const {
+        vector<Location> all;
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (live[i]) {
+                all.push_back(locations[i]);
+            }
+        }
+        return all;
+    }
+
+    // The location closest to the point, or null if there are none;
+    // distanceKm receives its great-circle distance.
+    Location* nearestLocation(double latitude, double longitude, double& distanceKm) {
+        refreshIndex();
+        Point target = toPoint(latitude, longitude);
+        size_t best = locations.size();
+        double bestDistance = INFINITY;
+        nearest(0, tree.size(), 0, target, best, bestDistance);
+        for (size_t index : pending) {
+            double distance = squaredChord(points[index], target);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = index;
+            }
+        }
+        if (best == locations.size()) {
+            return nullptr;
+        }
+        distanceKm = chordToKm(bestDistance);
+        return &locations[best];
+    }
+
+    // Locations within radiusKm of the point, nearest first, with their
+    // distances.
+    vector<pair<double, Location>> locationsWithin(double latitude, double longitude, double radiusKm) {
+        refreshIndex();
+        Point target = toPoint(latitude, longitude);
+        double halfAngle = min(M_PI / 2, radiusKm / earthRadiusKm / 2);
+        double limit = 4 * sin(halfAngle) * sin(halfAngle);
+        vector<pair<double, size_t>> found;
+        within(0, tree.size(), 0, target, limit, found);
+        for (size_t index : pending) {
+            double distance = squaredChord(points[index], target);
+            if (distance <= limit) {
+                found.emplace_back(distance, index);
+            }
+        }
+        sort(found.begin(), found.end());
+        vector<pair<double, Location>> result;
+        for (const auto& match : found) {
+            result.emplace_back(chordToKm(match.first), locations[match.second]);
+        }
+        return result;
+    }
+
+    // Groups the locations by the model grid cell (see modelCell) they
+    // fall in.
+    vector<LocationGroup> groupByModelCell(double resolution = modelGridDegrees) const {
+        vector<LocationGroup> groups;
+        unordered_map<int64_t, size_t> cells;
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (!live[i]) {
+                continue;
+            }
+            Location cell = modelCell(locations[i], resolution);
+            int64_t row = llround(cell.latitude / resolution);
+            int64_t column = llround(cell.longitude / resolution);
+            auto inserted = cells.emplace(row * 4000003 + column, groups.size());
+            if (inserted.second) {
+                groups.push_back(LocationGroup{ cell, {} });
+            }
+            groups[inserted.first->second].members.push_back(locations[i]);
+        }
+        return groups;
+    }
+};
+
+// Define the ResponseCache class
+// Two-tier cache of response bodies: an in-memory LRU bounded by size in
+// front of one file per key in a directory, so a restarted client finds
+// what it fetched before. Safe to use from several threads.
+class ResponseCache {
+private:
+    struct Entry {
+        string key;
+        string body;
+        time_t fetchedAt;
+    };
+
+    string directory;
+    size_t capacity;
+    size_t used = 0;
+    list<Entry> entries;    // most recently used first
+    unordered_map<string, list<Entry>::iterator> index;
+    mutex lock;
+
+    string pathFor(const string& key) const {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.cache", (unsigned long long)hash);
+        return directory + "/" + name;
+    }
+
+    void remember(const string& key, const string& body, time_t fetchedAt) {
+        auto found = index.find(key);
+        if (found != index.end()) {
+            used -= found->second->body.size();
+            entries.erase(found->second);
+        }
+        entries.push_front(Entry{ key, body, fetchedAt });
+        index[key] = entries.begin();
+        used += body.size();
+        while (used > capacity && entries.size() > 1) {
+            used -= entries.back().body.size();
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+public:
+    ResponseCache(const string& directory, size_t capacity = 64 << 20) : directory(directory), capacity(capacity) {
+        error_code error;
+        filesystem::create_directories(directory, error);
+    }
+
+    // Looks in memory first, then on disk.
+    bool get(const string& key, string& body, time_t& fetchedAt) {
+        lock_guard<mutex> guard(lock);
+        auto found = index.find(key);
+        if (found != index.end()) {
+            entries.splice(entries.begin(), entries, found->second);
+            body = found->second->body;
+            fetchedAt = found->second->fetchedAt;
+            return true;
+        }
+
+        // File layout: the key, the fetch time, then the body.
+        ifstream file(pathFor(key), ios::binary);
+        string storedKey;
+        if (!getline(file, storedKey) || storedKey != key || !(file >> fetchedAt) || file.get() != '\n') {
+            return false;
+        }
+        body.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        remember(key, body, fetchedAt);
+        return true;
+    }
+
+    void put(const string& key, const string& body, time_t fetchedAt) {
+        lock_guard<mutex> guard(lock);
+        remember(key, body, fetchedAt);
+
+        // Write then rename, so a crash never leaves a torn entry.
+        string path = pathFor(key);
+        string temporary = path + ".tmp";
+        {
+            ofstream file(temporary, ios::binary | ios::trunc);
+            file << key << '\n' << fetchedAt << '\n' << body;
+            if (!file) {
+                return;
+            }
+        }
+        error_code error;
+        filesystem::rename(temporary, path, error);
+    }
+};
+
+// Cache key for a data type at a location. Coordinates are quantized to
+// 0.01 degrees (about 1 km), so only locations about that close share an
+// entry.
+string cacheKey(const string& endpoint, const Location& location) {
+    char key[96];
+    snprintf(key, sizeof(key), "%s@%.2f,%.2f", endpoint.c_str(), location.latitude, location.longitude);
+    return key;
+}
+
+// How long cached data of one type is used. Within ttl it is served as is;
+// for staleSeconds after that it is still served, but refetched in the
+// background (stale-while-revalidate).
+struct CachePolicy {
+    time_t ttl;
+    time_t staleSeconds;
+};
+
+const CachePolicy forecastPolicy = { 60 * 60, 6 * 60 * 60 };
+const CachePolicy airQualityPolicy = { 15 * 60, 0 };
+
+// Days since 1970-01-01 for a YYYY-MM-DD date, or false if it is invalid.
+bool dayNumber(const string& date, long& day) {
+    int year, month, dayOfMonth;
+    char end;
+    if (sscanf(date.c_str(), "%4d-%2d-%2d%c", &year, &month, &dayOfMonth, &end) != 3 || month < 1 || month > 12) {
+        return false;
+    }
+    bool leapYear = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    int daysInMonth = month == 2 ? 28 + leapYear : 30 + (month + (month > 7)) % 2;
+    if (dayOfMonth < 1 || dayOfMonth > daysInMonth) {
+        return false;
+    }
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yearOfEra = year - era * 400;
+    long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + dayOfMonth - 1;
+    long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    day = era * 146097 + dayOfEra - 719468;
+    return true;
+}
+
+string dateString(long day) {
+    day += 719468;
+    long era = (day >= 0 ? day : day - 146096) / 146097;
+    long dayOfEra = day - era * 146097;
+    long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long monthIndex = (5 * dayOfYear + 2) / 153;
+    long dayOfMonth = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    long month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    long year = yearOfEra + era * 400 + (month <= 2);
+    char date[32];
+    snprintf(date, sizeof(date), "%04d-%02d-%02d", (int)year, (int)month, (int)dayOfMonth);
+    return date;
+}
+
+// Unix time of a "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM" timestamp in UTC.
+bool parseTimestamp(const string& text, int64_t& seconds) {
+    long day;
+    int hour = 0, minute = 0;
+    if (text.size() < 10 || !dayNumber(text.substr(0, 10), day)) {
+        return false;
+    }
+    if (text.size() > 10 && (text[10] != 'T' || sscanf(text.c_str() + 11, "%2d:%2d", &hour, &minute) != 2)) {
+        return false;
+    }
+    seconds = (int64_t)day * 86400 + hour * 3600 + minute * 60;
+    return true;
+}
+
+// Define the SeriesParser class
+// Incremental JSON parser that fills columns straight from a response as
+// curl delivers it, without building a document. It keeps just enough
+// state to find the arrays directly under one top-level section ("hourly"
+// or "daily"): "time" goes to a timestamp column, each registered field to
+// a float column (NaN for null), and everything else is skipped.
+class SeriesParser : public ResponseSink {
+private:
+    string section;
+    vector<int64_t>& time;
+    vector<pair<string, vector<float>*>> fields;
+    vector<float>* column = nullptr;    // float array being read, if any
+    bool inTime = false;                // reading the "time" array
+    string open;                        // '{' and '[' of the open containers
+    string sectionKey;                  // last key at depth 1
+    string fieldKey;                    // last key at depth 2
+    string token;
+    bool expectKey = false;
+    bool inString = false;
+    bool escaped = false;
+    bool inLiteral = false;
+    bool started = false;
+    bool failed = false;
+
+    static bool isLiteralChar(char c) {
+        return isalnum((unsigned char)c) || c == '-' || c == '+' || c == '.';
+    }
+
+    bool inColumn() const {
+        return open.size() == 3 && (column || inTime);
+    }
+
+    void stringToken() {
+        if (!open.empty() && open.back() == '{' && expectKey) {
+            if (open.size() == 1) {
+                sectionKey = token;
+            }
+            else if (open.size() == 2) {
+                fieldKey = token;
+            }
+            expectKey = false;
+        }
+        else if (inColumn()) {
+            int64_t seconds;
+            if (inTime && parseTimestamp(token, seconds)) {
+                time.push_back(seconds);
+            }
+            else {
+                failed = true;
+            }
+        }
+    }
+
+    void literalToken() {
+        if (!inColumn()) {
+            return;
+        }
+        char* end;
+        if (inTime) {
+            time.push_back(strtoll(token.c_str(), &end, 10));
+        }
+        else if (token == "null") {
+            column->push_back(NAN);
+            return;
+        }
+        else {
+            column->push_back(strtof(token.c_str(), &end));
+        }
+        failed = failed || *end != '\0';
+    }
+
+    void openContainer(char c) {
+        if (c == '[' && open.size() == 2 && open == "{{" && sectionKey == section) {
+            inTime = fieldKey == "time";
+            for (auto& field : fields) {
+                if (field.first == fieldKey) {
+                    column = field.second;
+                }
+            }
+        }
+        open += c;
+        expectKey = c == '{';
+        started = true;
+    }
+
+    void closeContainer(char c) {
+        if (open.empty() || open.back() != (c == '}' ? '{' : '[')) {
+            failed = true;
+            return;
+        }
+        open.pop_back();
+        if (open.size() == 2) {
+            column = nullptr;
+            inTime = false;
+        }
+    }
+
+public:
+    SeriesParser(const string& section, vector<int64_t>& time, const vector<pair<string, vector<float>*>>& fields)
+        : section(section), time(time), fields(fields) {}
+
+    void reset() override {
+        time.clear();
+        for (auto& field : fields) {
+            field.second->clear();
+        }
+        column = nullptr;
+        inTime = false;
+        open.clear();
+        sectionKey.clear();
+        fieldKey.clear();
+        token.clear();
+        expectKey = inString = escaped = inLiteral = started = failed = false;
+    }
+
+    void write(const char* data, size_t size) override {
+        for (size_t i = 0; i < size && !failed; ++i) {
+            char c = data[i];
+            if (inString) {
+                if (!escaped && c != '"' && c != '\\') {
+                    size_t end = i + 1;
+                    while (end < size && data[end] != '"' && data[end] != '\\') {
+                        ++end;
+                    }
+                    token.append(data + i, end - i);
+                    i = end - 1;
+                }
+                else if (escaped) {
+                    token += c;
+                    escaped = false;
+                }
+                else if (c == '\\') {
+                    escaped = true;
+                }
+                else if (c == '"') {
+                    inString = false;
+                    stringToken();
+                }
+                else {
+                    token += c;
+                }
+                continue;
+            }
+            if (inLiteral) {
+                if (isLiteralChar(c)) {
+                    size_t end = i + 1;
+                    while (end < size && isLiteralChar(data[end])) {
+                        ++end;
+                    }
+                    token.append(data + i, end - i);
+                    i = end - 1;
+                    continue;
+                }
+                inLiteral = false;
+                literalToken();
+            }
+            switch (c) {
+            case ' ': case '\t': case '\r': case '\n': case ':':
+                break;
+            case '{': case '[':
+                openContainer(c);
+                break;
+            case '}': case ']':
+                closeContainer(c);
+                break;
+            case ',':
+                expectKey = !open.empty() && open.back() == '{';
+                break;
+            case '"':
+                inString = true;
+                token.clear();
+                break;
+            default:
+                inLiteral = true;
+                token.assign(1, c);
+            }
+        }
+    }
+
+    // True if the whole response was read and every column has one value
+    // per timestamp.
+    bool finish() const {
+        if (failed || !started || !open.empty() || inString || time.empty()) {
+            return false;
+        }
+        for (auto& field : fields) {
+            if (field.second->size() != time.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Binary form of a series used by the cache: a 4-byte tag, the row count,
+// then the time column and each float column.
+string encodeSeries(const char* tag, const vector<int64_t>& time, const vector<const vector<float>*>& columns) {
+    uint64_t rows = time.size();
+    string data(tag, 4);
+    data.append((const char*)&rows, sizeof(rows));
+    data.append((const char*)time.data(), rows * sizeof(int64_t));
+    for (const vector<float>* column : columns) {
+        data.append((const char*)column->data(), rows * sizeof(float));
+    }
+    return data;
+}
+
+bool decodeSeries(const string& data, const char* tag, vector<int64_t>& time, const vector<vector<float>*>& columns) {
+    uint64_t rows;
+    if (data.size() < 4 + sizeof(rows) || data.compare(0, 4, tag, 4) != 0) {
+        return false;
+    }
+    memcpy(&rows, data.data() + 4, sizeof(rows));
+    if (data.size() != 4 + sizeof(rows) + rows * (sizeof(int64_t) + columns.size() * sizeof(float))) {
+        return false;
+    }
+    const char* at = data.data() + 4 + sizeof(rows);
+    time.resize(rows);
+    memcpy(time.data(), at, rows * sizeof(int64_t));
+    at += rows * sizeof(int64_t);
+    for (vector<float>* column : columns) {
+        column->resize(rows);
+        memcpy(column->data(), at, rows * sizeof(float));
+        at += rows * sizeof(float);
+    }
+    return true;
+}
+
+// Hourly forecast for one location, one entry per hour in each column.
+// An empty forecast means it could not be fetched.
+struct Forecast {
+    vector<int64_t> time;           // unix seconds, UTC
+    vector<float> temperature;      // temperature_2m, degrees C
+    vector<float> precipitation;    // mm
+
+    SeriesParser parser() {
+        return SeriesParser("hourly", time, { { "temperature_2m", &temperature }, { "precipitation", &precipitation } });
+    }
+
+    string encode() const {
+        return encodeSeries("FCS1", time, { &temperature, &precipitation });
+    }
+
+    bool decode(const string& data) {
+        return decodeSeries(data, "FCS1", time, { &temperature, &precipitation });
+    }
+};
+
+// Variables stored for each day of a History, in column order.
+const char* const historyVariables[] = { "temperature_2m_max", "temperature_2m_min" };
+const size_t historyColumnCount = 2;
+
+// Daily history for one location, sorted by day. An empty history means it
+// could not be fetched.
+struct History {
+    vector<int64_t> time;           // start of each day, unix seconds, UTC
+    vector<float> temperatureMax;   // temperature_2m_max, degrees C
+    vector<float> temperatureMin;   // temperature_2m_min, degrees C
+
+    SeriesParser parser() {
+        return SeriesParser("daily", time, { { "temperature_2m_max", &temperatureMax }, { "temperature_2m_min", &temperatureMin } });
+    }
+
+    // Column of historyVariables[variable].
+    vector<float>& column(size_t variable) {
+        return variable == 0 ? temperatureMax : temperatureMin;
+    }
+
+    const vector<float>& column(size_t variable) const {
+        return variable == 0 ? temperatureMax : temperatureMin;
+    }
+
+    bool hasDay(long day) const {
+        return binary_search(time.begin(), time.end(), (int64_t)day * 86400);
+    }
+
+    // Days in [firstDay, lastDay].
+    History slice(long firstDay, long lastDay) const {
+        History part;
+        size_t begin = lower_bound(time.begin(), time.end(), (int64_t)firstDay * 86400) - time.begin();
+        size_t end = upper_bound(time.begin(), time.end(), (int64_t)lastDay * 86400) - time.begin();
+        part.time.assign(time.begin() + begin, time.begin() + end);
+        for (size_t column = 0; column < historyColumnCount; ++column) {
+            part.column(column).assign(this->column(column).begin() + begin, this->column(column).begin() + end);
+        }
+        return part;
+    }
+
+    // Adds the days of other, which win over days already present. Returns
+    // true if a day before beforeDay was new.
+    bool merge(const History& other, long beforeDay) {
+        History merged;
+        bool added = false;
+        size_t i = 0, j = 0;
+        while (i < time.size() || j < other.time.size()) {
+            bool takeOther = j < other.time.size() && (i == time.size() || other.time[j] <= time[i]);
+            const History& from = takeOther ? other : *this;
+            size_t at = takeOther ? j : i;
+            if (takeOther) {
+                added = added || ((i == time.size() || other.time[j] < time[i]) && other.time[j] < (int64_t)beforeDay * 86400);
+                i += i < time.size() && time[i] == other.time[j];
+                ++j;
+            }
+            else {
+                ++i;
+            }
+            merged.time.push_back(from.time[at]);
+            for (size_t column = 0; column < historyColumnCount; ++column) {
+                merged.column(column).push_back(from.column(column)[at]);
+            }
+        }
+        *this = move(merged);
+        return added;
+    }
+};
+
+void printValues(const vector<float>& values) {
+    for (float value : values) {
+        if (isnan(value)) {
+            cout << "null ";
+        }
+        else {
+            cout << value << " ";
+        }
+    }
+}
+
+// Define the BitWriter and BitReader classes
+// Big-endian bit streams for the compressed history columns.
+class BitWriter {
+private:
+    string& out;
+    uint64_t buffer = 0;
+    int pending = 0;    // bits in buffer not yet written to out
+
+public:
+    BitWriter(string& out) : out(out) {}
+
+    void write(uint64_t value, int bits) {
+        if (bits > 32) {
+            write(value >> 32, bits - 32);
+            bits = 32;
+        }
+        buffer = (buffer << bits) | (value & ((1ull << bits) - 1));
+        pending += bits;
+        while (pending >= 8) {
+            pending -= 8;
+            out += (char)(buffer >> pending);
+        }
+    }
+
+    void flush() {
+        if (pending > 0) {
+            out += (char)(buffer << (8 - pending));
+            pending = 0;
+        }
+    }
+};
+
+class BitReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+    uint64_t buffer = 0;
+    int available = 0;
+
+public:
+    BitReader(const char* data, size_t size) : data((const uint8_t*)data), size(size) {}
+
+    // Reads past the end return zero bits; overrun() then reports it.
+    uint64_t read(int bits) {
+        if (bits > 32) {
+            uint64_t high = read(bits - 32);
+            return (high << 32) | read(32);
+        }
+        if (available < bits && position + 8 <= size) {
+            // Refill whole bytes from one unaligned big-endian load.
+            uint64_t word;
+            memcpy(&word, data + position, sizeof(word));
+            int bytes = min(7, (64 - available) / 8);
+            buffer = (buffer << (bytes * 8)) | (__builtin_bswap64(word) >> (64 - bytes * 8));
+            position += bytes;
+            available += bytes * 8;
+        }
+        while (available < bits) {
+            buffer = (buffer << 8) | (position < size ? data[position] : 0);
+            ++position;
+            available += 8;
+        }
+        available -= bits;
+        return (buffer >> available) & ((1ull << bits) - 1);
+    }
+
+    bool overrun() const {
+        return position > size;
+    }
+};
+
+// Timestamps are stored as delta-of-deltas, so a regular series costs one
+// bit per row: '0' for no change, else a prefix and a signed field sized
+// to the change.
+void encodeTimes(const int64_t* times, size_t rows, string& out) {
+    BitWriter bits(out);
+    int64_t previous = 0, previousDelta = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        int64_t delta = times[i] - previous;
+        int64_t change = delta - previousDelta;
+        if (i == 0) {
+            bits.write(times[i], 64);
+            delta = 0;
+        }
+        else if (change == 0) {
+            bits.write(0, 1);
+        }
+        else if (change >= -64 && change < 64) {
+            bits.write(0b10, 2);
+            bits.write(change, 7);
+        }
+        else if (change >= -2048 && change < 2048) {
+            bits.write(0b110, 3);
+            bits.write(change, 12);
+        }
+        else if (change >= INT32_MIN && change <= INT32_MAX) {
+            bits.write(0b1110, 4);
+            bits.write(change, 32);
+        }
+        else {
+            bits.write(0b1111, 4);
+            bits.write(change, 64);
+        }
+        previous = times[i];
+        previousDelta = delta;
+    }
+    bits.flush();
+}
+
+int64_t signExtend(uint64_t value, int bits) {
+    return bits == 64 ? (int64_t)value : (int64_t)(value << (64 - bits)) >> (64 - bits);
+}
+
+bool decodeTimes(const char* data, size_t size, size_t rows, int64_t* times) {
+    BitReader bits(data, size);
+    int64_t previous = 0, delta = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        if (i == 0) {
+            times[i] = bits.read(64);
+        }
+        else {
+            int64_t change = 0;
+            if (bits.read(1) == 1) {
+                if (bits.read(1) == 0) {
+                    change = signExtend(bits.read(7), 7);
+                }
+                else if (bits.read(1) == 0) {
+                    change = signExtend(bits.read(12), 12);
+                }
+                else if (bits.read(1) == 0) {
+                    change = signExtend(bits.read(32), 32);
+                }
+                else {
+                    change = signExtend(bits.read(64), 64);
+                }
+            }
+            delta += change;
+            times[i] = previous + delta;
+        }
+        previous = times[i];
+    }
+    return !bits.overrun();
+}
+
+// Floats are XORed with their predecessor, as in Gorilla: '0' for a repeat,
+// '10' and the meaningful bits if they fit the previous window of leading
+// and trailing zeros, else '11', the new window and the bits.
+void encodeFloats(const float* values, size_t rows, string& out) {
+    BitWriter bits(out);
+    uint32_t previous = 0;
+    int leading = -1, trailing = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        uint32_t value;
+        memcpy(&value, &values[i], sizeof(value));
+        uint32_t change = value ^ previous;
+        previous = value;
+        if (i == 0) {
+            bits.write(value, 32);
+            continue;
+        }
+        if (change == 0) {
+            bits.write(0, 1);
+            continue;
+        }
+        int newLeading = __builtin_clz(change);
+        int newTrailing = __builtin_ctz(change);
+        if (leading >= 0 && newLeading >= leading && newTrailing >= trailing) {
+            bits.write(0b10, 2);
+            bits.write(change >> trailing, 32 - leading - trailing);
+        }
+        else {
+            leading = newLeading;
+            trailing = newTrailing;
+            int meaningful = 32 - leading - trailing;
+            bits.write(0b11, 2);
+            bits.write(leading, 5);
+            bits.write(meaningful - 1, 5);
+            bits.write(change >> trailing, meaningful);
+        }
+    }
+    bits.flush();
+}
+
+bool decodeFloats(const char* data, size_t size, size_t rows, float* values) {
+    BitReader bits(data, size);
+    uint32_t previous = 0;
+    int leading = 0, trailing = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        uint32_t value;
+        if (i == 0) {
+            value = (uint32_t)bits.read(32);
+        }
+        else if (bits.read(1) == 0) {
+            value = previous;
+        }
+        else {
+            if (bits.read(1) == 1) {
+                leading = (int)bits.read(5);
+                trailing = 32 - leading - ((int)bits.read(5) + 1);
+                if (trailing < 0) {
+                    return false;
+                }
+            }
+            value = previous ^ ((uint32_t)bits.read(32 - leading - trailing) << trailing);
+        }
+        memcpy(&values[i], &value, sizeof(value));
+        previous = value;
+    }
+    return !bits.overrun();
+}
+
+// Running count, minimum, maximum and sum of the non-NaN values of a
+// column.
+struct SeriesStats {
+    size_t count = 0;
+    float min = INFINITY;
+    float max = -INFINITY;
+    double sum = 0;
+    vector<pair<double, float>> percentiles;    // fraction, value
+
+    double mean() const {
+        return count ? sum / count : NAN;
+    }
+
+    void add(const float* values, size_t size) {
+        size_t i = 0;
+#if defined(__SSE2__)
+        // Four lanes at a time; NaNs are masked to +-inf for min and max and
+        // to 0 for the sum.
+        const __m128 positiveInfinity = _mm_set1_ps(INFINITY);
+        const __m128 negativeInfinity = _mm_set1_ps(-INFINITY);
+        __m128 lanesMin = positiveInfinity, lanesMax = negativeInfinity, lanesSum = _mm_setzero_ps();
+        __m128i lanesCount = _mm_setzero_si128();
+        for (; i + 4 <= size; i += 4) {
+            __m128 v = _mm_loadu_ps(values + i);
+            __m128 valid = _mm_cmpord_ps(v, v);
+            __m128 present = _mm_and_ps(valid, v);
+            lanesMin = _mm_min_ps(lanesMin, _mm_or_ps(present, _mm_andnot_ps(valid, positiveInfinity)));
+            lanesMax = _mm_max_ps(lanesMax, _mm_or_ps(present, _mm_andnot_ps(valid, negativeInfinity)));
+            lanesSum = _mm_add_ps(lanesSum, present);
+            lanesCount = _mm_sub_epi32(lanesCount, _mm_castps_si128(valid));
+        }
+        float mins[4], maxs[4], sums[4];
+        int32_t counts[4];
+        _mm_storeu_ps(mins, lanesMin);
+        _mm_storeu_ps(maxs, lanesMax);
+        _mm_storeu_ps(sums, lanesSum);
+        _mm_storeu_si128((__m128i*)counts, lanesCount);
+        for (int lane = 0; lane < 4; ++lane) {
+            min = fmin(min, mins[lane]);
+            max = fmax(max, maxs[lane]);
+            sum += sums[lane];
+            count += counts[lane];
+        }
+#endif
+        for (; i < size; ++i) {
+            if (!isnan(values[i])) {
+                min = fmin(min, values[i]);
+                max = fmax(max, values[i]);
+                sum += values[i];
+                ++count;
+            }
+        }
+    }
+
+    void merge(const SeriesStats& other) {
+        count += other.count;
+        min = fmin(min, other.min);
+        max = fmax(max, other.max);
+        sum += other.sum;
+    }
+};
+
+// Define the MappedFile class
+// Read-only memory mapping of a whole file.
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+
+public:
+    MappedFile(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0) {
+            return;
+        }
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = (const char*)mapping;
+                size = info.st_size;
+            }
+        }
+        close(fd);
+    }
 
-    Location(string name, double lat, double lon) : name(name), latitude(lat), longitude(lon) {}
+    ~MappedFile() {
+        if (data) {
+            munmap((void*)data, size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const { return data; }
+    size_t length() const { return size; }
+};
+
+// Define the HistoryStore class
+// Local columnar store of daily history, one file per location:
+//
+//   HistoryFileHeader, chunkCount HistoryChunk entries, chunk columns
+//
+// Each chunk holds up to historyChunkRows consecutive rows. Its time column
+// and each variable's column are compressed separately (encodeTimes,
+// encodeFloats), so a query decodes only the chunks that overlap its range
+// and only the columns it needs, reading them through a memory mapping.
+struct HistoryFileHeader {
+    char magic[4];
+    uint32_t chunkCount;
+    char key[56];       // cacheKey of the location, to detect hash collisions
+};
+
+struct HistoryChunk {
+    int64_t firstTime;
+    int64_t lastTime;
+    uint64_t rows;
+    uint64_t offset[1 + historyColumnCount];  // time column, then each variable
+    uint64_t size[1 + historyColumnCount];
 };
 
-// Define the WeatherVariable class
-class WeatherVariable {
+const char historyMagic[4] = { 'W', 'H', 'S', '1' };
+const size_t historyChunkRows = 1024;
+
+class HistoryStore {
+private:
+    string directory;
+
+    string pathFor(const Location& location) const {
+        string key = cacheKey("history", location);
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.whs", (unsigned long long)hash);
+        return directory + "/" + name;
+    }
+
+    // The chunk directory of a mapped file, or null if the file is missing,
+    // belongs to another location or is damaged. Every column takes at least
+    // one bit per row, which bounds the row count a chunk can claim before
+    // anything is allocated for it.
+    const HistoryChunk* chunks(const MappedFile& file, const Location& location, uint32_t& count) const {
+        const HistoryFileHeader* header = (const HistoryFileHeader*)file.begin();
+        if (file.length() < sizeof(HistoryFileHeader) || memcmp(header->magic, historyMagic, 4) != 0 ||
+            strncmp(header->key, cacheKey("history", location).c_str(), sizeof(header->key)) != 0 ||
+            header->chunkCount > (file.length() - sizeof(HistoryFileHeader)) / sizeof(HistoryChunk)) {
+            return nullptr;
+        }
+        count = header->chunkCount;
+        const HistoryChunk* chunk = (const HistoryChunk*)(file.begin() + sizeof(HistoryFileHeader));
+        for (uint32_t i = 0; i < count; ++i) {
+            if (chunk[i].rows == 0 || chunk[i].firstTime > chunk[i].lastTime) {
+                return nullptr;
+            }
+            for (size_t column = 0; column <= historyColumnCount; ++column) {
+                if (chunk[i].offset[column] > file.length() || chunk[i].size[column] > file.length() - chunk[i].offset[column] ||
+                    chunk[i].rows > 8 * chunk[i].size[column]) {
+                    return nullptr;
+                }
+            }
+        }
+        return chunk;
+    }
+
+    // Calls visit(chunk, rows from, rows to) with the row range of every
+    // chunk that overlaps [firstDay, lastDay]. times is filled only when the
+    // chunk is cut by the range, or when needTimes is set.
+    template <typename Visit>
+    bool forEachChunk(const Location& location, long firstDay, long lastDay, bool needTimes, Visit visit) const {
+        MappedFile file(pathFor(location));
+        uint32_t count;
+        const HistoryChunk* chunk = chunks(file, location, count);
+        if (!chunk) {
+            return false;
+        }
+        int64_t firstTime = (int64_t)firstDay * 86400, lastTime = (int64_t)lastDay * 86400;
+        vector<int64_t> times;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (chunk[i].lastTime < firstTime || chunk[i].firstTime > lastTime) {
+                continue;
+            }
+            size_t from = 0, to = chunk[i].rows;
+            if (needTimes || chunk[i].firstTime < firstTime || chunk[i].lastTime > lastTime) {
+                times.resize(chunk[i].rows);
+                if (!decodeTimes(file.begin() + chunk[i].offset[0], chunk[i].size[0], chunk[i].rows, times.data())) {
+                    return false;
+                }
+                from = lower_bound(times.begin(), times.end(), firstTime) - times.begin();
+                to = upper_bound(times.begin(), times.end(), lastTime) - times.begin();
+            }
+            if (!visit(file, chunk[i], times, from, to)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
 public:
-    string name;
-    double value;
+    HistoryStore(const string& directory) : directory(directory) {
+        error_code error;
+        filesystem::create_directories(directory, error);
+    }
+
+    // Days of the location in [firstDay, lastDay] that are in the store.
+    History load(const Location& location, long firstDay, long lastDay) const {
+        History history;
+        vector<float> values;
+        bool ok = forEachChunk(location, firstDay, lastDay, true,
+            [&](const MappedFile& file, const HistoryChunk& chunk, const vector<int64_t>& times, size_t from, size_t to) {
+                history.time.insert(history.time.end(), times.begin() + from, times.begin() + to);
+                values.resize(chunk.rows);
+                for (size_t column = 0; column < historyColumnCount; ++column) {
+                    if (!decodeFloats(file.begin() + chunk.offset[column + 1], chunk.size[column + 1], chunk.rows, values.data())) {
+                        return false;
+                    }
+                    history.column(column).insert(history.column(column).end(), values.begin() + from, values.begin() + to);
+                }
+                return true;
+            });
+        return ok ? history : History();
+    }
+
+    // Merges days into the stored history of the location, rewriting its
+    // file (through a temporary file and a rename) if anything is new.
+    bool save(const Location& location, const History& days) {
+        History history = load(location, LONG_MIN / 86400, LONG_MAX / 86400);
+        if (!history.merge(days, LONG_MAX / 86400)) {
+            return true;
+        }
+
+        HistoryFileHeader header = {};
+        memcpy(header.magic, historyMagic, 4);
+        header.chunkCount = (uint32_t)((history.time.size() + historyChunkRows - 1) / historyChunkRows);
+        strncpy(header.key, cacheKey("history", location).c_str(), sizeof(header.key) - 1);
+        vector<HistoryChunk> directoryEntries(header.chunkCount);
+        string payload;
+        uint64_t base = sizeof(header) + header.chunkCount * sizeof(HistoryChunk);
+        for (size_t i = 0; i < header.chunkCount; ++i) {
+            size_t first = i * historyChunkRows;
+            size_t rows = min(historyChunkRows, history.time.size() - first);
+            HistoryChunk& chunk = directoryEntries[i];
+            chunk.firstTime = history.time[first];
+            chunk.lastTime = history.time[first + rows - 1];
+            chunk.rows = rows;
+            for (size_t column = 0; column <= historyColumnCount; ++column) {
+                chunk.offset[column] = base + payload.size();
+                if (column == 0) {
+                    encodeTimes(history.time.data() + first, rows, payload);
+                }
+                else {
+                    encodeFloats(history.column(column - 1).data() + first, rows, payload);
+                }
+                chunk.size[column] = base + payload.size() - chunk.offset[column];
+            }
+        }
+
+        string path = pathFor(location);
+        string temporary = path + ".tmp";
+        {
+            ofstream file(temporary, ios::binary | ios::trunc);
+            file.write((const char*)&header, sizeof(header));
+            file.write((const char*)directoryEntries.data(), directoryEntries.size() * sizeof(HistoryChunk));
+            file << payload;
+            if (!file) {
+                cerr << "Error: Could not write to the file " << temporary << endl;
+                return false;
+            }
+        }
+        error_code error;
+        filesystem::rename(temporary, path, error);
+        return !error;
+    }
+
+    // Statistics of one variable over [firstDay, lastDay] pooled across the
+    // locations, plus the requested percentiles (fractions in [0, 1],
+    // linearly interpolated). Chunks wholly inside the range are aggregated
+    // without decoding their timestamps. As with load(), a location whose
+    // file is missing or damaged adds nothing.
+    SeriesStats stats(const vector<Location>& locations, size_t variable, long firstDay, long lastDay,
+        const vector<double>& percentiles = {}) const {
+        SeriesStats total;
+        vector<float> values, kept;
+        for (const Location& location : locations) {
+            SeriesStats stats;
+            size_t keptBefore = kept.size();
+            bool ok = forEachChunk(location, firstDay, lastDay, false,
+                [&](const MappedFile& file, const HistoryChunk& chunk, const vector<int64_t>&, size_t from, size_t to) {
+                    values.resize(chunk.rows);
+                    if (!decodeFloats(file.begin() + chunk.offset[variable + 1], chunk.size[variable + 1], chunk.rows, values.data())) {
+                        return false;
+                    }
+                    stats.add(values.data() + from, to - from);
+                    if (!percentiles.empty()) {
+                        copy_if(values.begin() + from, values.begin() + to, back_inserter(kept), [](float value) { return !isnan(value); });
+                    }
+                    return true;
+                });
+            if (ok) {
+                total.merge(stats);
+            }
+            else {
+                kept.resize(keptBefore);
+            }
+        }
 
-    WeatherVariable(const string& n, double v) : name(n), value(v) {}
+        sort(kept.begin(), kept.end());
+        for (double fraction : percentiles) {
+            float value = NAN;
+            if (!kept.empty()) {
+                double rank = min(max(fraction, 0.0), 1.0) * (kept.size() - 1);
+                size_t below = (size_t)rank;
+                size_t above = min(below + 1, kept.size() - 1);
+                value = (float)(kept[below] + (rank - below) * (kept[above] - kept[below]));
+            }
+            total.percentiles.emplace_back(fraction, value);
+        }
+        return total;
+    }
+
+    // Trailing mean of one variable over the window days ending at each
+    // stored day in [firstDay, lastDay], one value per day that load()
+    // returns for the range. NaNs and missing days are left out; a window
+    // with no values gives NaN.
+    vector<float> rollingMean(const Location& location, size_t variable, long firstDay, long lastDay, size_t window) const {
+        History history = load(location, firstDay - (long)window + 1, lastDay);
+        const vector<float>& values = history.column(variable);
+        int64_t span = (int64_t)window * 86400;
+        vector<float> means;
+        double sum = 0;
+        size_t count = 0;
+        for (size_t i = 0, tail = 0; i < values.size(); ++i) {
+            if (!isnan(values[i])) {
+                sum += values[i];
+                ++count;
+            }
+            for (; tail <= i && history.time[tail] <= history.time[i] - span; ++tail) {
+                if (!isnan(values[tail])) {
+                    sum -= values[tail];
+                    --count;
+                }
+            }
+            if (history.time[i] >= (int64_t)firstDay * 86400) {
+                means.push_back(count ? (float)(sum / count) : NAN);
+            }
+        }
+        return means;
+    }
 };
 
 // Define the WeatherForecastingSystem class
 class WeatherForecastingSystem {
 private:
     string apiKey;
+    FetchEngine& engine;
+    ResponseCache& cache;
+    string baseUrl;
+    FetchEngine background{ 8 };    // used only by the revalidation thread
+    thread revalidation;
+    mutex staleLock;
+    vector<Location> staleQueue;
+    unordered_set<string> staleKeys;    // cache keys in staleQueue
+    bool revalidating = false;
+    bool stopping = false;
+
+    string forecastUrl(const Location& location) const {
+        return baseUrl + "/v1/forecast?latitude=" + to_string(location.latitude) + "&longitude=" + to_string(location.longitude) + "&hourly=temperature_2m,precipitation&timeformat=unixtime";
+    }
+
+    // Fetches the forecasts of the given locations concurrently, parsing each
+    // as it arrives, and caches the ones that succeed.
+    void fetchInto(FetchEngine& fetcher, const vector<Location>& locations, vector<Forecast>& forecasts) {
+        vector<string> urls;
+        vector<SeriesParser> parsers;
+        vector<ResponseSink*> sinks;
+        parsers.reserve(locations.size());
+        for (size_t i = 0; i < locations.size(); ++i) {
+            urls.push_back(forecastUrl(locations[i]));
+            parsers.push_back(forecasts[i].parser());
+            sinks.push_back(&parsers.back());
+        }
+        vector<FetchResult> results = fetcher.fetchAll(urls, sinks);
+        time_t now = time(nullptr);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (!results[i].ok() || !parsers[i].finish()) {
+                cerr << "Error fetching forecast for " << locations[i].name << ": "
+                     << (results[i].ok() ? "unexpected response" : results[i].error) << endl;
+                forecasts[i] = Forecast();
+                continue;
+            }
+            cache.put(cacheKey("forecast", locations[i]), forecasts[i].encode(), now);
+        }
+    }
+
+    // Queues stale forecasts for refetching on a background thread with its
+    // own engine. The thread takes whatever is queued, one batch at a time,
+    // and ends once the queue is empty; forecasts queued meanwhile join the
+    // next batch instead of being dropped.
+    void revalidate(const vector<Location>& locations) {
+        lock_guard<mutex> lock(staleLock);
+        for (const Location& location : locations) {
+            if (staleKeys.insert(cacheKey("forecast", location)).second) {
+                staleQueue.push_back(location);
+            }
+        }
+        if (staleQueue.empty() || revalidating) {
+            return;
+        }
+        revalidating = true;
+        if (revalidation.joinable()) {
+            revalidation.join();    // finished: it cleared revalidating
+        }
+        revalidation = thread([this] {
+            while (true) {
+                vector<Location> batch;
+                {
+                    lock_guard<mutex> lock(staleLock);
+                    if (staleQueue.empty() || stopping) {
+                        revalidating = false;
+                        return;
+                    }
+                    batch.swap(staleQueue);
+                    staleKeys.clear();
+                }
+                vector<Forecast> forecasts(batch.size());
+                fetchInto(background, batch, forecasts);
+            }
+        });
+    }
 
 public:
-    WeatherForecastingSystem(const string& api_key) : apiKey(api_key) {}
+    WeatherForecastingSystem(const string& api_key, FetchEngine& engine, ResponseCache& cache,
+        const string& baseUrl = "https://api.open-meteo.com")
+        : apiKey(api_key), engine(engine), cache(cache), baseUrl(baseUrl) {}
+
+    // Waits for the batch in flight; anything still queued is dropped.
+    ~WeatherForecastingSystem() {
+        {
+            lock_guard<mutex> lock(staleLock);
+            stopping = true;
+        }
+        if (revalidation.joinable()) {
+            revalidation.join();
+        }
+    }
+
+    Forecast fetchForecast(const Location& location) {
+        return fetchForecasts({ location })[0];
+    }
 
-    json fetchForecast(const Location& location) {
-        CURL* curl;
-        CURLcode res;
-        string readBuffer;
-        json data;
+    // Returns the forecasts of all locations in the same order. Locations
+    // with the same cache key share one entry and at most one request; with
+    // byModelCell, so do all locations in one grid cell (see modelCell),
+    // which is meant for bulk refreshes and exports. Cached ones are served
+    // without a request; the rest are fetched concurrently.
+    vector<Forecast> fetchForecasts(const vector<Location>& locations, bool byModelCell = false) {
+        vector<Location> targets;
+        vector<size_t> targetOf(locations.size());
+        unordered_map<string, size_t> targetIndex;
+        for (size_t i = 0; i < locations.size(); ++i) {
+            // Named after the first location asking, for error messages.
+            Location target = byModelCell ? modelCell(locations[i]) : locations[i];
+            target.name = locations[i].name;
+            auto inserted = targetIndex.emplace(cacheKey("forecast", target), targets.size());
+            if (inserted.second) {
+                targets.push_back(target);
+            }
+            targetOf[i] = inserted.first->second;
+        }
 
-        curl = curl_easy_init();
-        if (curl) {
-            string url = "https://api.open-meteo.com/v1/forecast?latitude=" + to_string(location.latitude) + "&longitude=" + to_string(location.longitude) + "&hourly=temperature_2m,precipitation";
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK) {
-                cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << endl;
+        vector<Forecast> targetForecasts(targets.size());
+        vector<size_t> missing;
+        vector<Location> stale;
+        time_t now = time(nullptr);
+        for (size_t i = 0; i < targets.size(); ++i) {
+            string data;
+            time_t fetchedAt;
+            if (cache.get(cacheKey("forecast", targets[i]), data, fetchedAt) &&
+                now - fetchedAt < forecastPolicy.ttl + forecastPolicy.staleSeconds && targetForecasts[i].decode(data)) {
+                if (now - fetchedAt >= forecastPolicy.ttl) {
+                    stale.push_back(targets[i]);
+                }
+                continue;
             }
-            curl_easy_cleanup(curl);
+            missing.push_back(i);
+        }
 
-            // Parse the response
-            data = json::parse(readBuffer);
+        vector<Location> fetchLocations;
+        for (size_t i : missing) {
+            fetchLocations.push_back(targets[i]);
         }
-        return data;
+        vector<Forecast> fetched(missing.size());
+        fetchInto(engine, fetchLocations, fetched);
+        for (size_t j = 0; j < missing.size(); ++j) {
+            targetForecasts[missing[j]] = move(fetched[j]);
+        }
+        revalidate(stale);
+
+        vector<Forecast> forecasts(locations.size());
+        for (size_t i = 0; i < locations.size(); ++i) {
+            forecasts[i] = targetForecasts[targetOf[i]];
+        }
+        return forecasts;
     }
 
-    void displayForecast(const json& forecastData) const {
+    void displayForecast(const Forecast& forecast) const {
         cout << "Temperature: ";
-        for (const auto& temp : forecastData["hourly"]["temperature_2m"]) {
-            cout << temp << " ";
-        }
+        printValues(forecast.temperature);
         cout << endl;
 
         cout << "Precipitation: ";
-        for (const auto& precip : forecastData["hourly"]["precipitation"]) {
-            cout << precip << " ";
-        }
+        printValues(forecast.precipitation);
         cout << endl;
     }
 };
@@ -85,73 +1789,160 @@ public:
 class HistoricalWeatherSystem {
 private:
     string apiKey;
+    FetchEngine& engine;
+    HistoryStore& store;
+    string baseUrl;
+
+    string historyUrl(const Location& location, const string& startDate, const string& endDate) const {
+        return baseUrl + "/v1/forecast?latitude=" + to_string(location.latitude) + "&longitude=" + to_string(location.longitude) + "&daily=temperature_2m_max,temperature_2m_min&start_date=" + startDate + "&end_date=" + endDate + "&timeformat=unixtime";
+    }
 
 public:
-    HistoricalWeatherSystem(const string& api_key) : apiKey(api_key) {}
+    HistoricalWeatherSystem(const string& api_key, FetchEngine& engine, HistoryStore& store,
+        const string& baseUrl = "https://api.open-meteo.com")
+        : apiKey(api_key), engine(engine), store(store), baseUrl(baseUrl) {}
+
+    History fetchHistoricalData(const Location& location, const string& startDate, const string& endDate) {
+        return fetchHistoricalData(vector<Location>{ location }, startDate, endDate)[0];
+    }
+
+    // Returns the same date range for all locations. Past days never change,
+    // so they are kept in the HistoryStore, which grows as ranges are
+    // requested; only the days it lacks are fetched, concurrently.
+    vector<History> fetchHistoricalData(const vector<Location>& locations, const string& startDate, const string& endDate) {
+        vector<History> history(locations.size());
+        long first, last;
+        if (!dayNumber(startDate, first) || !dayNumber(endDate, last) || first > last) {
+            cerr << "Error: invalid date range " << startDate << " to " << endDate << endl;
+            return history;
+        }
 
-    json fetchHistoricalData(const Location& location, const string& startDate, const string& endDate) {
-        CURL* curl;
-        CURLcode res;
-        string readBuffer;
-        json data;
+        long today = time(nullptr) / 86400;
+        vector<History> known(locations.size());
+        vector<size_t> missing;
+        vector<string> urls;
+        for (size_t i = 0; i < locations.size(); ++i) {
+            known[i] = store.load(locations[i], first, last);
+            // Days from today on are still changing and are never stored.
+            long firstMissing = last + 1, lastMissing = first - 1;
+            for (long day = first; day <= last; ++day) {
+                if (day >= today || !known[i].hasDay(day)) {
+                    firstMissing = min(firstMissing, day);
+                    lastMissing = day;
+                }
+            }
+            if (firstMissing <= lastMissing) {
+                missing.push_back(i);
+                urls.push_back(historyUrl(locations[i], dateString(firstMissing), dateString(lastMissing)));
+            }
+        }
 
-        curl = curl_easy_init();
-        if (curl) {
-            string url = "https://api.open-meteo.com/v1/forecast?latitude=" + to_string(location.latitude) + "&longitude=" + to_string(location.longitude) + "&daily=temperature_2m_max,temperature_2m_min&start_date=" + startDate + "&end_date=" + endDate;
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK) {
-                cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << endl;
+        vector<History> fetched(missing.size());
+        vector<SeriesParser> parsers;
+        vector<ResponseSink*> sinks;
+        parsers.reserve(missing.size());
+        for (History& part : fetched) {
+            parsers.push_back(part.parser());
+            sinks.push_back(&parsers.back());
+        }
+        vector<FetchResult> results = engine.fetchAll(urls, sinks);
+        vector<bool> failed(locations.size(), false);
+        for (size_t j = 0; j < results.size(); ++j) {
+            size_t i = missing[j];
+            if (!results[j].ok() || !parsers[j].finish()) {
+                cerr << "Error fetching historical data for " << locations[i].name << ": "
+                     << (results[j].ok() ? "unexpected response" : results[j].error) << endl;
+                failed[i] = true;
+                continue;
+            }
+            known[i].merge(fetched[j], today);
+            if (!fetched[j].time.empty() && fetched[j].time.front() < (int64_t)today * 86400) {
+                store.save(locations[i], fetched[j].slice(fetched[j].time.front() / 86400, today - 1));
             }
-            curl_easy_cleanup(curl);
+        }
 
-            // Parse the response
-            data = json::parse(readBuffer);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            if (!failed[i]) {
+                history[i] = known[i].slice(first, last);
+            }
         }
-        return data;
+        return history;
     }
 
-    void displayHistoricalData(const json& historicalData) const {
+    void displayHistoricalData(const History& history) const {
         cout << "Historical Temperature Data: ";
-        for (const auto& temp : historicalData["daily"]["temperature_2m_max"]) {
-            cout << temp << " ";
-        }
+        printValues(history.temperatureMax);
         cout << endl;
     }
+
+    // Prints statistics of every stored variable of the location over the
+    // range, and the latest 7-day rolling mean.
+    void displayStatistics(const Location& location, long firstDay, long lastDay) const {
+        for (size_t variable = 0; variable < historyColumnCount; ++variable) {
+            SeriesStats stats = store.stats({ location }, variable, firstDay, lastDay, { 0.1, 0.5, 0.9 });
+            cout << historyVariables[variable] << ": ";
+            if (stats.count == 0) {
+                cout << "no data" << endl;
+                continue;
+            }
+            vector<float> rolling = store.rollingMean(location, variable, firstDay, lastDay, 7);
+            cout << stats.count << " days, min " << stats.min << ", max " << stats.max << ", mean " << stats.mean()
+                 << ", p10 " << stats.percentiles[0].second << ", median " << stats.percentiles[1].second
+                 << ", p90 " << stats.percentiles[2].second << ", last 7-day mean " << rolling.back() << endl;
+        }
+    }
 };
 
 // Define the AirQualityForecastingSystem class
 class AirQualityForecastingSystem {
 private:
     string apiKey;
+    FetchEngine& engine;
+    ResponseCache& cache;
+    string baseUrl;
+
+    string airQualityUrl(const Location& location) const {
+        return baseUrl + "/feed/geo:" + to_string(location.latitude) + ";" + to_string(location.longitude) + "/?token=" + apiKey;
+    }
 
 public:
-    AirQualityForecastingSystem(const string& api_key) : apiKey(api_key) {}
+    AirQualityForecastingSystem(const string& api_key, FetchEngine& engine, ResponseCache& cache,
+        const string& baseUrl = "https://api.waqi.info")
+        : apiKey(api_key), engine(engine), cache(cache), baseUrl(baseUrl) {}
 
     json fetchAirQuality(const Location& location) {
-        CURL* curl;
-        CURLcode res;
-        string readBuffer;
-        json data;
+        return fetchAirQuality(vector<Location>{ location })[0];
+    }
 
-        curl = curl_easy_init();
-        if (curl) {
-            string url = "https://api.waqi.info/feed/geo:" + to_string(location.latitude) + ";" + to_string(location.longitude) + "/?token=" + apiKey;
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-            res = curl_easy_perform(curl);
-            if (res != CURLE_OK) {
-                cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << endl;
+    // Returns the air quality of all locations, fetching the ones not
+    // cached within airQualityPolicy.ttl concurrently.
+    vector<json> fetchAirQuality(const vector<Location>& locations) {
+        vector<json> airQuality(locations.size());
+        vector<size_t> missing;
+        vector<string> urls;
+        time_t now = time(nullptr);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            string body;
+            time_t fetchedAt;
+            if (cache.get(cacheKey("air_quality", locations[i]), body, fetchedAt) && now - fetchedAt < airQualityPolicy.ttl) {
+                airQuality[i] = json::parse(body, nullptr, false);
+                if (!airQuality[i].is_discarded()) {
+                    continue;
+                }
             }
-            curl_easy_cleanup(curl);
+            missing.push_back(i);
+            urls.push_back(airQualityUrl(locations[i]));
+        }
 
-            // Parse the response
-            data = json::parse(readBuffer);
+        vector<FetchResult> results = engine.fetchAll(urls);
+        for (size_t j = 0; j < results.size(); ++j) {
+            size_t i = missing[j];
+            airQuality[i] = parseResponse(results[j], "air quality for " + locations[i].name);
+            if (!airQuality[i].is_null()) {
+                cache.put(cacheKey("air_quality", locations[i]), results[j].body, now);
+            }
         }
-        return data;
+        return airQuality;
     }
 
     void displayAirQuality(const json& airQualityData) const {
@@ -160,68 +1951,360 @@ public:
 };
 
 // Define data export functions
-void exportToCSV(const Location& location, const vector<WeatherVariable>& weatherVariables, const string& filename) {
-    ofstream file(filename);
-    if (file.is_open()) {
-        file << "Location: " << location.name << ", Latitude: " << location.latitude << ", Longitude: " << location.longitude << endl;
-        file << "Weather Variable,Value" << endl;
-        for (const auto& var : weatherVariables) {
-            file << var.name << "," << var.value << endl;
-        }
-        file.close();
+// Forecasts and histories are exported as one row per location and time,
+// in one of three formats chosen by the file extension:
+//
+//   .csv      location,latitude,longitude,time,<variables>
+//   .ndjson   one JSON object per row
+//   .wcol     binary columnar: a schema header (exportMagic, column count,
+//             column names), then one block per location: name, latitude,
+//             longitude, row count, the int64 time column (unix seconds)
+//             and one float column per variable
+//
+// Every format can be appended to; a file's existing header must match.
+enum ExportFormat { csvExport, jsonLinesExport, columnarExport };
+
+const char exportMagic[4] = { 'W', 'C', 'O', 'L' };
+const size_t exportBufferSize = 1 << 20;
+const size_t exportBatchSize = 256;     // forecasts fetched per batch
+
+bool exportFormatFor(const string& path, ExportFormat& format) {
+    string extension = filesystem::path(path).extension().string();
+    if (extension == ".csv") {
+        format = csvExport;
+    }
+    else if (extension == ".ndjson" || extension == ".jsonl") {
+        format = jsonLinesExport;
+    }
+    else if (extension == ".wcol") {
+        format = columnarExport;
     }
     else {
-        cout << "Failed to open file for writing." << endl;
+        return false;
     }
+    return true;
 }
 
-void exportToJSON(const Location& location, const vector<WeatherVariable>& weatherVariables, const string& filename) {
-    json j;
-    j["Location"]["Name"] = location.name;
-    j["Location"]["Latitude"] = location.latitude;
-    j["Location"]["Longitude"] = location.longitude;
+void appendFloat(string& out, float value) {
+    char text[32];
+    auto result = to_chars(text, text + sizeof(text), value);
+    out.append(text, result.ptr);
+}
 
-    for (const auto& var : weatherVariables) {
-        json varJson;
-        varJson["name"] = var.name;
-        varJson["value"] = var.value;
-        j["WeatherData"].push_back(varJson);
+void appendJsonString(string& out, const string& text) {
+    out += '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        }
+        else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out += (char)c;
+        }
     }
+    out += '"';
+}
 
-    ofstream file(filename);
-    if (file.is_open()) {
-        file << j.dump(4);
-        file.close();
+void appendCsvField(string& out, const string& text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) {
+        out += text;
+        return;
     }
-    else {
-        cout << "Failed to open file for writing." << endl;
+    out += '"';
+    for (char c : text) {
+        out += c;
+        if (c == '"') {
+            out += '"';
+        }
     }
+    out += '"';
 }
 
-void exportToTXT(const Location& location, const vector<WeatherVariable>& weatherVariables, const string& filename) {
-    ofstream file(filename);
-    if (file.is_open()) {
-        file << "Location Information:\n";
-        file << "  Name: " << location.name << "\n";
-        file << "  Latitude: " << location.latitude << "\n";
-        file << "  Longitude: " << location.longitude << "\n\n";
-        file << "Weather Data:\n";
-        for (const auto& var : weatherVariables) {
-            file << "  " << var.name << ": " << var.value << "\n";
+// Define the SeriesExporter class
+// Streams series for many locations into one file. Worker threads format
+// each location's rows into a block while the calling thread writes
+// finished blocks in location order through a large buffer, so memory stays
+// bounded by a few blocks per thread however many rows are exported.
+class SeriesExporter {
+private:
+    string path;
+    ExportFormat format;
+    vector<string> columns;
+    bool daily;
+    size_t threads;
+    ofstream file;
+    string buffer;
+    size_t rows = 0;
+    bool failed = false;
+
+    string header() const {
+        string text;
+        if (format == csvExport) {
+            text = "location,latitude,longitude,time";
+            for (const string& column : columns) {
+                text += "," + column;
+            }
+            text += '\n';
+        }
+        else if (format == columnarExport) {
+            uint32_t count = (uint32_t)columns.size();
+            text.append(exportMagic, 4);
+            text.append((const char*)&count, sizeof(count));
+            for (const string& column : columns) {
+                uint16_t length = (uint16_t)column.size();
+                text.append((const char*)&length, sizeof(length));
+                text += column;
+            }
         }
-        file.close();
+        return text;
     }
-    else {
-        cout << "Failed to open file for writing." << endl;
+
+    void appendTime(string& out, int64_t time) const {
+        long day = (long)(time >= 0 ? time / 86400 : (time - 86399) / 86400);
+        out += dateString(day);
+        if (!daily) {
+            char clock[8];
+            long seconds = (long)(time - (int64_t)day * 86400);
+            snprintf(clock, sizeof(clock), "T%02d:%02d", (int)(seconds / 3600), (int)(seconds / 60 % 60));
+            out += clock;
+        }
     }
-}
+
+    void formatBlock(const Location& location, const vector<int64_t>& time, const vector<const vector<float>*>& values,
+        string& out) const {
+        if (format == columnarExport) {
+            uint16_t length = (uint16_t)min<size_t>(location.name.size(), UINT16_MAX);
+            uint64_t count = time.size();
+            out.append((const char*)&length, sizeof(length));
+            out.append(location.name, 0, length);
+            out.append((const char*)&location.latitude, sizeof(double));
+            out.append((const char*)&location.longitude, sizeof(double));
+            out.append((const char*)&count, sizeof(count));
+            out.append((const char*)time.data(), count * sizeof(int64_t));
+            for (const vector<float>* column : values) {
+                out.append((const char*)column->data(), count * sizeof(float));
+            }
+            return;
+        }
+
+        // The parts of each row that name the location are the same for
+        // every row, so they are formatted once.
+        string prefix;
+        if (format == csvExport) {
+            appendCsvField(prefix, location.name);
+            prefix += "," + to_string(location.latitude) + "," + to_string(location.longitude) + ",";
+        }
+        else {
+            prefix = "{\"location\":";
+            appendJsonString(prefix, location.name);
+            prefix += ",\"latitude\":" + to_string(location.latitude) + ",\"longitude\":" + to_string(location.longitude) + ",\"time\":\"";
+        }
+        for (size_t row = 0; row < time.size(); ++row) {
+            out += prefix;
+            appendTime(out, time[row]);
+            if (format == jsonLinesExport) {
+                out += '"';
+            }
+            for (size_t column = 0; column < values.size(); ++column) {
+                float value = (*values[column])[row];
+                if (format == csvExport) {
+                    out += ',';
+                    if (!isnan(value)) {
+                        appendFloat(out, value);
+                    }
+                }
+                else {
+                    out += ",\"" + columns[column] + "\":";
+                    if (isnan(value)) {
+                        out += "null";
+                    }
+                    else {
+                        appendFloat(out, value);
+                    }
+                }
+            }
+            out += format == csvExport ? "\n" : "}\n";
+        }
+    }
+
+    void write(const string& data) {
+        buffer += data;
+        if (buffer.size() >= exportBufferSize) {
+            flush();
+        }
+    }
+
+    void flush() {
+        file.write(buffer.data(), buffer.size());
+        buffer.clear();
+        if (!file) {
+            failed = true;
+        }
+    }
+
+    // Runs formatOne(i, block, rows) for i in [0, count) on worker threads
+    // and writes the blocks in order, with at most 2 * threads of them
+    // formatted but not yet written. An empty block writes nothing.
+    template <typename FormatOne>
+    void writeOrdered(size_t count, FormatOne formatOne) {
+        size_t window = 2 * threads;
+        vector<string> blocks(window);
+        vector<size_t> blockRows(window);
+        vector<bool> ready(window, false);
+        size_t claimed = 0, written = 0;
+        mutex lock;
+        condition_variable changed;
+
+        auto work = [&] {
+            string block;
+            while (true) {
+                size_t index;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [&] { return claimed >= count || claimed < written + window; });
+                    if (claimed >= count) {
+                        return;
+                    }
+                    index = claimed++;
+                }
+                size_t blockRowCount = 0;
+                block.clear();
+                formatOne(index, block, blockRowCount);
+                {
+                    lock_guard<mutex> guard(lock);
+                    blocks[index % window].swap(block);
+                    blockRows[index % window] = blockRowCount;
+                    ready[index % window] = true;
+                }
+                changed.notify_all();
+            }
+        };
+
+        vector<thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(work);
+        }
+        string block;
+        for (size_t index = 0; index < count; ++index) {
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] { return ready[index % window]; });
+                block.swap(blocks[index % window]);
+                rows += blockRows[index % window];
+                ready[index % window] = false;
+                ++written;
+            }
+            changed.notify_all();
+            write(block);
+        }
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+public:
+    // Opens path for the given variables, appending if asked and the file
+    // already exists. daily selects date-only timestamps in text formats.
+    SeriesExporter(const string& path, const vector<string>& columns, bool daily, bool append, size_t threads)
+        : path(path), columns(columns), daily(daily), threads(max<size_t>(1, threads)) {
+        if (!exportFormatFor(path, format)) {
+            cerr << "Error: " << path << " must end in .csv, .ndjson or .wcol" << endl;
+            failed = true;
+            return;
+        }
+        string expected = header();
+        error_code error;
+        bool appending = append && filesystem::file_size(path, error) > 0 && !error;
+        if (appending && !expected.empty()) {
+            ifstream existing(path, ios::binary);
+            string found(expected.size(), '\0');
+            existing.read(&found[0], found.size());
+            if (found != expected) {
+                cerr << "Error: " << path << " holds different columns and cannot be appended to" << endl;
+                failed = true;
+                return;
+            }
+        }
+        file.open(path, ios::binary | (appending ? ios::app : ios::trunc));
+        if (!file) {
+            cerr << "Error: Could not write to the file " << path << endl;
+            failed = true;
+            return;
+        }
+        buffer.reserve(exportBufferSize + (64 << 10));
+        if (!appending) {
+            write(expected);
+        }
+    }
+
+    bool isOpen() const {
+        return !failed;
+    }
+
+    size_t rowsWritten() const {
+        return rows;
+    }
+
+    // Fetches the forecasts of the locations in batches, one per model grid
+    // cell, and exports each batch as it arrives. Locations whose forecast
+    // cannot be fetched are skipped in every format.
+    void exportForecasts(WeatherForecastingSystem& weatherSystem, const vector<Location>& locations) {
+        for (size_t begin = 0; begin < locations.size() && !failed; begin += exportBatchSize) {
+            vector<Location> batch(locations.begin() + begin, locations.begin() + min(locations.size(), begin + exportBatchSize));
+            vector<Forecast> forecasts = weatherSystem.fetchForecasts(batch, true);
+            writeOrdered(batch.size(), [&](size_t i, string& block, size_t& blockRows) {
+                if (forecasts[i].time.empty()) {
+                    return;
+                }
+                formatBlock(batch[i], forecasts[i].time, { &forecasts[i].temperature, &forecasts[i].precipitation }, block);
+                blockRows = forecasts[i].time.size();
+            });
+        }
+    }
+
+    // Exports the stored history of each location in [firstDay, lastDay].
+    // Locations with no stored days in the range are skipped.
+    void exportHistory(const HistoryStore& store, const vector<Location>& locations, long firstDay, long lastDay) {
+        writeOrdered(locations.size(), [&](size_t i, string& block, size_t& blockRows) {
+            History history = store.load(locations[i], firstDay, lastDay);
+            if (history.time.empty()) {
+                return;
+            }
+            vector<const vector<float>*> values;
+            for (size_t column = 0; column < historyColumnCount; ++column) {
+                values.push_back(&history.column(column));
+            }
+            formatBlock(locations[i], history.time, values, block);
+            blockRows = history.time.size();
+        });
+    }
+
+    // Writes out what is buffered; returns false if any write failed.
+    bool close() {
+        if (file.is_open()) {
+            flush();
+            file.close();
+            failed = failed || !file;
+        }
+        return !failed;
+    }
+};
 
 // Define the main function with a console-based UI
 int main() {
     LocationManager locationManager;
-    WeatherForecastingSystem weatherSystem("YOUR_WEATHER_API_KEY");
-    HistoricalWeatherSystem historicalSystem("YOUR_HISTORICAL_API_KEY");
-    AirQualityForecastingSystem airQualitySystem("YOUR_AIR_QUALITY_API_KEY");
+    FetchEngine fetchEngine;
+    ResponseCache cache("weather_cache");
+    HistoryStore historyStore("weather_history");
+    string openMeteoUrl = apiUrl("OPEN_METEO_URL", "https://api.open-meteo.com");
+    WeatherForecastingSystem weatherSystem("YOUR_WEATHER_API_KEY", fetchEngine, cache, openMeteoUrl);
+    HistoricalWeatherSystem historicalSystem("YOUR_HISTORICAL_API_KEY", fetchEngine, historyStore, openMeteoUrl);
+    AirQualityForecastingSystem airQualitySystem("YOUR_AIR_QUALITY_API_KEY", fetchEngine, cache, apiUrl("WAQI_URL", "https://api.waqi.info"));
 
     while (true) {
         cout << "\n1. Add Location" << endl;
@@ -230,8 +2313,11 @@ int main() {
         cout << "4. Fetch Weather Forecast" << endl;
         cout << "5. Fetch Historical Weather Data" << endl;
         cout << "6. Fetch Air Quality Data" << endl;
-        cout << "7. Export Data" << endl;
-        cout << "8. Exit" << endl;
+        cout << "7. Export Forecasts or History" << endl;
+        cout << "8. Historical Statistics" << endl;
+        cout << "9. Refresh All Forecasts" << endl;
+        cout << "10. Find Nearby Locations" << endl;
+        cout << "11. Exit" << endl;
 
         int choice;
         cin >> choice;
@@ -267,8 +2353,10 @@ int main() {
             cin >> name;
             Location* location = locationManager.findLocation(name);
             if (location) {
-                json forecastData = weatherSystem.fetchForecast(*location);
-                weatherSystem.displayForecast(forecastData);
+                Forecast forecast = weatherSystem.fetchForecast(*location);
+                if (!forecast.time.empty()) {
+                    weatherSystem.displayForecast(forecast);
+                }
             }
             else {
                 cout << "Location not found." << endl;
@@ -285,8 +2373,10 @@ int main() {
             cin >> endDate;
             Location* location = locationManager.findLocation(name);
             if (location) {
-                json historicalData = historicalSystem.fetchHistoricalData(*location, startDate, endDate);
-                historicalSystem.displayHistoricalData(historicalData);
+                History history = historicalSystem.fetchHistoricalData(*location, startDate, endDate);
+                if (!history.time.empty()) {
+                    historicalSystem.displayHistoricalData(history);
+                }
             }
             else {
                 cout << "Location not found." << endl;
@@ -300,7 +2390,9 @@ int main() {
             Location* location = locationManager.findLocation(name);
             if (location) {
                 json airQualityData = airQualitySystem.fetchAirQuality(*location);
-                airQualitySystem.displayAirQuality(airQualityData);
+                if (!airQualityData.is_null()) {
+                    airQualitySystem.displayAirQuality(airQualityData);
+                }
             }
             else {
                 cout << "Location not found." << endl;
@@ -308,30 +2400,138 @@ int main() {
             break;
         }
         case 7: {
-            string name;
-            double temperature, windSpeed;
-            cout << "Enter location name for export: ";
+            string kind, name, path, append, startDate, endDate;
+            cout << "Export forecasts or history? (f/h): ";
+            cin >> kind;
+            cout << "Enter location name, or * for all locations: ";
             cin >> name;
-            cout << "Enter temperature: ";
-            cin >> temperature;
-            cout << "Enter wind speed: ";
-            cin >> windSpeed;
-            Location* location = locationManager.findLocation(name);
-            if (location) {
-                vector<WeatherVariable> weatherVariables = {
-                    WeatherVariable("Temperature", temperature),
-                    WeatherVariable("Wind Speed", windSpeed)
-                };
-                exportToCSV(*location, weatherVariables, "data.csv");
-                exportToJSON(*location, weatherVariables, "data.json");
-                exportToTXT(*location, weatherVariables, "data.txt");
+            cout << "Enter output file (.csv, .ndjson or .wcol): ";
+            cin >> path;
+            cout << "Append if the file exists? (y/n): ";
+            cin >> append;
+            long first = 0, last = 0;
+            if (kind == "h") {
+                cout << "Enter start date (YYYY-MM-DD): ";
+                cin >> startDate;
+                cout << "Enter end date (YYYY-MM-DD): ";
+                cin >> endDate;
+                if (!dayNumber(startDate, first) || !dayNumber(endDate, last) || first > last) {
+                    cout << "Invalid date range." << endl;
+                    break;
+                }
+            }
+
+            vector<Location> selected;
+            if (name == "*") {
+                selected = locationManager.allLocations();
+            }
+            else if (Location* location = locationManager.findLocation(name)) {
+                selected.push_back(*location);
+            }
+            if (selected.empty()) {
+                cout << "Location not found." << endl;
+                break;
+            }
+
+            vector<string> columns = kind == "h" ? vector<string>(historyVariables, historyVariables + historyColumnCount)
+                                                 : vector<string>{ "temperature_2m", "precipitation" };
+            SeriesExporter exporter(path, columns, kind == "h", append == "y", max(1u, thread::hardware_concurrency()));
+            if (!exporter.isOpen()) {
+                break;
+            }
+            if (kind == "h") {
+                // Fills the store with any missing days first, a batch at a time.
+                for (size_t begin = 0; begin < selected.size(); begin += exportBatchSize) {
+                    vector<Location> batch(selected.begin() + begin, selected.begin() + min(selected.size(), begin + exportBatchSize));
+                    historicalSystem.fetchHistoricalData(batch, startDate, endDate);
+                    exporter.exportHistory(historyStore, batch, first, last);
+                }
             }
             else {
+                exporter.exportForecasts(weatherSystem, selected);
+            }
+            if (exporter.close()) {
+                cout << "Exported " << exporter.rowsWritten() << " rows for " << selected.size() << " location(s) to " << path << "." << endl;
+            }
+            else {
+                cerr << "Error: Could not write to the file " << path << endl;
+            }
+            break;
+        }
+        case 8: {
+            string name, startDate, endDate;
+            long first, last;
+            cout << "Enter location name for statistics: ";
+            cin >> name;
+            cout << "Enter start date (YYYY-MM-DD): ";
+            cin >> startDate;
+            cout << "Enter end date (YYYY-MM-DD): ";
+            cin >> endDate;
+            Location* location = locationManager.findLocation(name);
+            if (!location) {
                 cout << "Location not found." << endl;
             }
+            else if (!dayNumber(startDate, first) || !dayNumber(endDate, last) || first > last) {
+                cout << "Invalid date range." << endl;
+            }
+            else {
+                // Fills the store with any missing days first.
+                historicalSystem.fetchHistoricalData(*location, startDate, endDate);
+                historicalSystem.displayStatistics(*location, first, last);
+            }
+            break;
+        }
+        case 9: {
+            // One request per model grid cell, all cells concurrently. The
+            // results are cached per cell, so a later export of any member
+            // is served from the cache; single forecasts are not.
+            vector<LocationGroup> groups = locationManager.groupByModelCell();
+            vector<Location> cells;
+            for (const auto& group : groups) {
+                cells.push_back(group.cell);
+            }
+            vector<Forecast> forecasts = weatherSystem.fetchForecasts(cells, true);
+            size_t refreshed = 0;
+            for (size_t i = 0; i < groups.size(); ++i) {
+                if (forecasts[i].time.empty()) {
+                    continue;
+                }
+                SeriesStats temperature, precipitation;
+                temperature.add(forecasts[i].temperature.data(), forecasts[i].temperature.size());
+                precipitation.add(forecasts[i].precipitation.data(), forecasts[i].precipitation.size());
+                for (const Location& member : groups[i].members) {
+                    cout << member.name << ": " << temperature.min << " to " << temperature.max << " C, "
+                         << precipitation.sum << " mm" << endl;
+                }
+                refreshed += groups[i].members.size();
+            }
+            cout << "Refreshed forecasts for " << refreshed << " of " << locationManager.size() << " locations in "
+                 << groups.size() << " grid cells." << endl;
+            break;
+        }
+        case 10: {
+            double latitude, longitude, radiusKm;
+            cout << "Enter latitude: ";
+            cin >> latitude;
+            cout << "Enter longitude: ";
+            cin >> longitude;
+            cout << "Enter radius in km: ";
+            cin >> radiusKm;
+            double distanceKm;
+            Location* nearest = locationManager.nearestLocation(latitude, longitude, distanceKm);
+            if (!nearest) {
+                cout << "No locations." << endl;
+                break;
+            }
+            cout << "Nearest: " << nearest->name << " (" << distanceKm << " km)" << endl;
+            vector<pair<double, Location>> nearby = locationManager.locationsWithin(latitude, longitude, radiusKm);
+            cout << nearby.size() << " location(s) within " << radiusKm << " km" << endl;
+            for (size_t i = 0; i < nearby.size() && i < 20; ++i) {
+                cout << "  " << nearby[i].second.name << " (" << nearby[i].first << " km)" << endl;
+            }
             break;
         }
-        case 8:
+        case 11:
             return 0;
         default:
             cout << "Invalid choice. Please try again." << endl;
@@ -2,9 +2,31 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iomanip>
 #include <algorithm>
 #include <limits>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <cerrno>
+#include <csignal>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -14,30 +36,1737 @@ public:
     string name;
     string phoneNumber;
 
-    Contact(int id, string name, string phoneNumber) : id(id), name(name), phoneNumber(phoneNumber) {}
+    Contact(int id, string_view name, string_view phoneNumber) : id(id), name(name), phoneNumber(phoneNumber) {}
 };
 
-class ContactManager {
+const size_t maxNameLength = 80;
+const size_t maxPhoneLength = 30;
+
+// Contact store file layout: a 4 KiB header page followed by fixed-size
+// record slots. Deleted slots are chained into a free list through
+// nextFree and reused by later inserts, so the file only grows when every
+// slot is in use.
+struct StoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t capacity;   // slots the file has room for
+    uint64_t highWater;  // slots ever used; everything above is untouched
+    uint64_t liveCount;
+    int64_t freeHead;    // first free slot below highWater, or -1
+};
+
+struct ContactRecord {
+    uint32_t live;
+    int32_t id;
+    int64_t nextFree;
+    uint8_t nameLength;
+    uint8_t phoneLength;
+    char name[maxNameLength];
+    char phone[maxPhoneLength];
+};
+
+static_assert(sizeof(ContactRecord) == 128, "contact records must stay 128 bytes");
+
+// One write-ahead log entry: the new image of a single slot plus the header
+// fields after the change. Replaying an entry twice has the same effect as
+// replaying it once, so recovery needs no sequence bookkeeping.
+struct WalEntry {
+    uint32_t crc;
+    uint32_t magic;
+    uint64_t slot;
+    uint64_t highWater;
+    uint64_t liveCount;
+    int64_t freeHead;
+    ContactRecord record;
+};
+
+const char storeMagic[4] = { 'D', 'C', 'O', 'N' };
+const uint32_t storeVersion = 1;
+const uint32_t walMagic = 0x4C41574B;
+const size_t headerSize = 4096;
+const uint64_t initialCapacity = 1024;
+const off_t walCheckpointSize = 1 << 20;
+
+uint32_t crc32(const void* data, size_t size) {
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+            t[i] = crc;
+        }
+        return t;
+    }();
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = (crc >> 8) ^ table[(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+// Open-addressing hash table from a 64-bit key to record slots, using linear
+// probing and backward-shift deletion so no tombstones build up. Several
+// slots may share a key.
+class SlotIndex {
+private:
+    struct Entry {
+        uint64_t key;
+        int64_t slot;  // -1: empty
+    };
+
+    vector<Entry> table;
+    size_t count = 0;
+
+    size_t mask() const {
+        return table.size() - 1;
+    }
+
+    size_t home(uint64_t key) const {
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+        return key & mask();
+    }
+
+    void place(const Entry& entry) {
+        size_t i = home(entry.key);
+        while (table[i].slot >= 0) {
+            i = (i + 1) & mask();
+        }
+        table[i] = entry;
+    }
+
+    void resize(size_t size) {
+        vector<Entry> old(size, Entry{ 0, -1 });
+        old.swap(table);
+        for (const Entry& entry : old) {
+            if (entry.slot >= 0) {
+                place(entry);
+            }
+        }
+    }
+
+public:
+    SlotIndex() : table(16, Entry{ 0, -1 }) {}
+
+    // Sizes the table for count entries up front, so a bulk load does not
+    // rehash on the way.
+    void reserve(size_t count) {
+        size_t size = table.size();
+        while (count * 4 > size * 3) {
+            size *= 2;
+        }
+        if (size != table.size()) {
+            resize(size);
+        }
+    }
+
+    void insert(uint64_t key, int64_t slot) {
+        // Keep the load factor under 3/4.
+        if ((count + 1) * 4 > table.size() * 3) {
+            resize(table.size() * 2);
+        }
+        place(Entry{ key, slot });
+        ++count;
+    }
+
+    void erase(uint64_t key, int64_t slot) {
+        size_t i = home(key);
+        while (table[i].slot >= 0 && (table[i].key != key || table[i].slot != slot)) {
+            i = (i + 1) & mask();
+        }
+        if (table[i].slot < 0) {
+            return;
+        }
+        // Pull later entries of the probe chain back into the hole unless
+        // that would move them in front of their home bucket.
+        for (size_t j = (i + 1) & mask(); table[j].slot >= 0; j = (j + 1) & mask()) {
+            if (((j - home(table[j].key)) & mask()) >= ((j - i) & mask())) {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i].slot = -1;
+        --count;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Calls visit(slot) for every slot stored under key until it returns true.
+    template <typename Visit>
+    void find(uint64_t key, Visit visit) const {
+        for (size_t i = home(key); table[i].slot >= 0; i = (i + 1) & mask()) {
+            if (table[i].key == key && visit(table[i].slot)) {
+                return;
+            }
+        }
+    }
+};
+
+// Phone numbers are compared by their digits only, so "+1 (555) 010-2030"
+// and "15550102030" are the same number.
+string normalizePhone(string_view phoneNumber) {
+    string digits;
+    for (char c : phoneNumber) {
+        if (isdigit((unsigned char)c)) {
+            digits += c;
+        }
+    }
+    return digits;
+}
+
+string lowerCase(string_view text) {
+    string lower(text);
+    for (char& c : lower) {
+        c = (char)tolower((unsigned char)c);
+    }
+    return lower;
+}
+
+// Hash of normalizePhone(phoneNumber), without building the string.
+uint64_t phoneHash(string_view phoneNumber) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (char c : phoneNumber) {
+        if (isdigit((unsigned char)c)) {
+            hash = (hash ^ (uint8_t)c) * 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+// Case-insensitive three-way comparison of a and b.
+int compareLower(string_view a, string_view b) {
+    size_t n = min(a.size(), b.size());
+    for (size_t i = 0; i < n; ++i) {
+        int x = tolower((unsigned char)a[i]);
+        int y = tolower((unsigned char)b[i]);
+        if (x != y) {
+            return x - y;
+        }
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size();
+}
+
+// Eight lower-cased bytes of a name from offset on, packed big-endian, so
+// that comparing keys as integers orders names like compareLower does.
+uint64_t nameKey(string_view name, size_t offset = 0) {
+    uint64_t key = 0;
+    for (size_t i = offset; i < offset + 8; ++i) {
+        key = (key << 8) | (i < name.size() ? (uint8_t)tolower((unsigned char)name[i]) : 0);
+    }
+    return key;
+}
+
+// One insert or erase in a group commit; ok is set by ContactStore::apply.
+struct ContactChange {
+    bool insert;
+    int id;
+    string name;
+    string phoneNumber;
+    bool ok = false;
+};
+
+// Memory-mapped contact store. Every change is first appended to the
+// write-ahead log and synced, then applied to the mapping in place; the
+// mapping is flushed and the log truncated at checkpoints. Opening the store
+// maps the file and replays whatever the log still holds.
+//
+// Lookups may run on any number of threads at once without locking, while
+// changes are serialized. The indexes exist twice (left-right concurrency
+// control): readers use the copy readSide points at, and a writer updates
+// the other copy, flips readSide, waits for the readers still on the old
+// copy to leave and then repeats the change there. Erased records are only
+// cleared, and replaced mappings only unmapped, after that wait, so nothing
+// a reader can still reach is ever overwritten or freed under it.
+class ContactStore {
+private:
+    string path;
+    string walPath;
+    int fd = -1;
+    int walFd = -1;
+    atomic<char*> base{ nullptr };
+    size_t mappedSize = 0;
+    vector<pair<char*, size_t>> retiredMappings;
+    mutex writeLock;
+
+    // Live slots sorted by lower-cased name, then slot. The key caches the
+    // start of the name so most comparisons stay inside the vector. A sorted
+    // vector rather than a tree: it is built with one sort on open and bulk
+    // imports merge into it. The price is that a single insert or erase is
+    // an O(n) move, on average half the entries of each of the two copies:
+    // about 16 MB of memmove per change per million contacts.
+    struct NameEntry {
+        uint64_t key;
+        uint64_t slot;
+    };
+
+    // In-memory indexes over the live slots, rebuilt from the mapping on
+    // open. Bulk inserts only queue their name entries in pendingNames;
+    // settleNames sorts them in once the import is done.
+    struct Indexes {
+        SlotIndex ids;
+        SlotIndex phones;
+        vector<NameEntry> names;
+        vector<NameEntry> pendingNames;
+    };
+
+    Indexes sides[2];
+    atomic<int> readSide{ 0 };
+    atomic<int> readEpoch{ 0 };
+    mutable atomic<long> readers[2] = { { 0 }, { 0 } };
+
+    // Registers a lookup for as long as it is in scope.
+    class ReadGuard {
+    private:
+        const ContactStore& store;
+        int epoch;
+
+    public:
+        ReadGuard(const ContactStore& store) : store(store), epoch(store.readEpoch.load()) {
+            store.readers[epoch].fetch_add(1);
+        }
+
+        ~ReadGuard() {
+            store.readers[epoch].fetch_sub(1);
+        }
+
+        const Indexes& indexes() const {
+            return store.sides[store.readSide.load()];
+        }
+    };
+
+    bool nameLess(const NameEntry& a, const NameEntry& b) const {
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        int order = compareLower(name(a.slot), name(b.slot));
+        return order != 0 ? order < 0 : a.slot < b.slot;
+    }
+
+    NameEntry nameEntry(uint64_t slot) const {
+        return NameEntry{ nameKey(name(slot)), slot };
+    }
+
+    // Sorts by the cached keys alone, then re-sorts each run of equal keys on
+    // the next eight bytes of the names, so names sharing a long prefix cost
+    // one record read per level instead of one per comparison.
+    void sortNames(vector<NameEntry>::iterator begin, vector<NameEntry>::iterator end, size_t offset = 0) const {
+        auto byKey = [](const NameEntry& a, const NameEntry& b) { return a.key != b.key ? a.key < b.key : a.slot < b.slot; };
+        sort(begin, end, byKey);
+        for (auto run = begin; run != end;) {
+            auto runEnd = run + 1;
+            while (runEnd != end && runEnd->key == run->key) {
+                ++runEnd;
+            }
+            // A key ending in a zero byte means every name in the run ends
+            // here, so they are equal and already ordered by slot.
+            if (runEnd - run > 1 && (run->key & 0xFF) != 0 && offset + 8 < maxNameLength) {
+                uint64_t key = run->key;
+                for (auto it = run; it != runEnd; ++it) {
+                    it->key = nameKey(name(it->slot), offset + 8);
+                }
+                sortNames(run, runEnd, offset + 8);
+                for (auto it = run; it != runEnd; ++it) {
+                    it->key = key;
+                }
+            }
+            run = runEnd;
+        }
+    }
+
+    // Sorts the pending entries into the name index: a few are placed by
+    // binary search in one pass over the index, many by sorting everything
+    // again.
+    void settleNames(Indexes& side) const {
+        if (side.pendingNames.empty()) {
+            return;
+        }
+        if (side.pendingNames.size() > side.names.size() / 16) {
+            side.names.insert(side.names.end(), side.pendingNames.begin(), side.pendingNames.end());
+            sortNames(side.names.begin(), side.names.end());
+        }
+        else {
+            auto less = [this](const NameEntry& a, const NameEntry& b) { return nameLess(a, b); };
+            sortNames(side.pendingNames.begin(), side.pendingNames.end());
+            vector<NameEntry> merged;
+            merged.reserve(side.names.size() + side.pendingNames.size());
+            auto from = side.names.begin();
+            for (const NameEntry& entry : side.pendingNames) {
+                auto at = upper_bound(from, side.names.end(), entry, less);
+                merged.insert(merged.end(), from, at);
+                merged.push_back(entry);
+                from = at;
+            }
+            merged.insert(merged.end(), from, side.names.end());
+            side.names.swap(merged);
+        }
+        side.pendingNames.clear();
+        side.pendingNames.shrink_to_fit();
+    }
+
+    StoreHeader& header() const {
+        return *(StoreHeader*)base.load(memory_order_relaxed);
+    }
+
+    ContactRecord& slotAt(uint64_t slot) const {
+        return *(ContactRecord*)(base.load(memory_order_relaxed) + headerSize + slot * sizeof(ContactRecord));
+    }
+
+    // Maps the file at its new size. The old mapping stays valid until the
+    // next publish, since readers may still hold it.
+    bool map(uint64_t capacity) {
+        size_t size = headerSize + capacity * sizeof(ContactRecord);
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            cerr << "Error mapping contact store.\n";
+            return false;
+        }
+        if (base.load()) {
+            retiredMappings.emplace_back(base.load(), mappedSize);
+        }
+        base.store((char*)mapping);
+        mappedSize = size;
+        return true;
+    }
+
+    void unmapRetired() {
+        for (const auto& mapping : retiredMappings) {
+            munmap(mapping.first, mapping.second);
+        }
+        retiredMappings.clear();
+    }
+
+    // Grows the file (doubling) until it has room for slot.
+    bool ensureCapacity(uint64_t slot) {
+        uint64_t capacity = header().capacity;
+        if (slot < capacity) {
+            return true;
+        }
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        if (ftruncate(fd, headerSize + capacity * sizeof(ContactRecord)) != 0 || !map(capacity)) {
+            cerr << "Error growing contact store.\n";
+            return false;
+        }
+        header().capacity = capacity;
+        return true;
+    }
+
+    static void fill(ContactRecord& record, int id, string_view name, string_view phoneNumber) {
+        record = ContactRecord();
+        record.live = 1;
+        record.id = id;
+        record.nextFree = -1;
+        record.nameLength = (uint8_t)name.size();
+        record.phoneLength = (uint8_t)phoneNumber.size();
+        memcpy(record.name, name.data(), name.size());
+        memcpy(record.phone, phoneNumber.data(), phoneNumber.size());
+    }
+
+    void apply(const WalEntry& entry) {
+        slotAt(entry.slot) = entry.record;
+        header().highWater = entry.highWater;
+        header().liveCount = entry.liveCount;
+        header().freeHead = entry.freeHead;
+    }
+
+    bool writeAll(int target, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(target, data, size);
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // Makes the changes durable in the log with a single sync. Each entry
+    // carries the header state after it, so a batch cut short by a crash
+    // replays as a consistent prefix.
+    bool log(WalEntry* entries, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            entries[i].magic = walMagic;
+            entries[i].crc = crc32((const char*)&entries[i] + sizeof(entries[i].crc), sizeof(WalEntry) - sizeof(entries[i].crc));
+        }
+        if (!writeAll(walFd, (const char*)entries, count * sizeof(WalEntry)) || fdatasync(walFd) != 0) {
+            cerr << "Error writing contact log.\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Runs change on the copy of the indexes readers are not using, switches
+    // readers over to it, waits until no reader is left on the old copy and
+    // runs change there too.
+    template <typename Change>
+    void publish(Change change) {
+        int next = 1 - readSide.load();
+        change(sides[next]);
+        readSide.store(next);
+        waitForReaders();
+        change(sides[1 - next]);
+        unmapRetired();
+    }
+
+    // Returns once every reader that started before the call has left.
+    // Readers register under the current epoch, so flipping the epoch and
+    // draining both counters covers every reader that might still see an
+    // old readSide or mapping.
+    void waitForReaders() {
+        int epoch = readEpoch.load();
+        while (readers[1 - epoch].load() != 0) {
+            this_thread::yield();
+        }
+        readEpoch.store(1 - epoch);
+        while (readers[epoch].load() != 0) {
+            this_thread::yield();
+        }
+    }
+
+    void index(Indexes& side, uint64_t slot) const {
+        side.ids.insert((uint32_t)slotAt(slot).id, slot);
+        side.phones.insert(phoneHash(phone(slot)), slot);
+        NameEntry entry = nameEntry(slot);
+        side.names.insert(upper_bound(side.names.begin(), side.names.end(), entry,
+            [this](const NameEntry& a, const NameEntry& b) { return nameLess(a, b); }), entry);
+    }
+
+    void unindex(Indexes& side, uint64_t slot) const {
+        side.ids.erase((uint32_t)slotAt(slot).id, slot);
+        side.phones.erase(phoneHash(phone(slot)), slot);
+        auto it = lower_bound(side.names.begin(), side.names.end(), nameEntry(slot),
+            [this](const NameEntry& a, const NameEntry& b) { return nameLess(a, b); });
+        if (it != side.names.end() && it->slot == slot) {
+            side.names.erase(it);
+        }
+    }
+
+    int64_t findSlot(const Indexes& side, int id) const {
+        int64_t found = -1;
+        side.ids.find((uint32_t)id, [&](int64_t slot) {
+            if (slotAt(slot).id != id) {
+                return false;
+            }
+            found = slot;
+            return true;
+        });
+        return found;
+    }
+
+    vector<uint64_t> findByPhone(const Indexes& side, const string& phoneNumber) const {
+        string digits = normalizePhone(phoneNumber);
+        vector<uint64_t> slots;
+        side.phones.find(phoneHash(digits), [&](int64_t slot) {
+            if (normalizePhone(phone(slot)) == digits) {
+                slots.push_back(slot);
+            }
+            return false;
+        });
+        sort(slots.begin(), slots.end());
+        return slots;
+    }
+
+    vector<uint64_t> findByNamePrefix(const Indexes& side, const string& prefix, size_t limit) const {
+        vector<uint64_t> slots;
+        auto it = lower_bound(side.names.begin(), side.names.end(), prefix,
+            [this](const NameEntry& entry, const string& key) { return compareLower(name(entry.slot), key) < 0; });
+        for (; it != side.names.end() && slots.size() < limit; ++it) {
+            string_view candidate = name(it->slot);
+            if (candidate.size() < prefix.size() || compareLower(candidate.substr(0, prefix.size()), prefix) != 0) {
+                break;
+            }
+            slots.push_back(it->slot);
+        }
+        return slots;
+    }
+
+    // Rewrites the store with the live records packed at the front and the
+    // file shrunk to fit, then swaps it in by rename so a crash leaves either
+    // the old or the new file whole. Slot numbers change, so this only runs
+    // on open, after the log is replayed and before the indexes are built.
+    bool compact() {
+        uint64_t capacity = initialCapacity;
+        while (capacity < header().liveCount) {
+            capacity *= 2;
+        }
+        string tempPath = path + ".compact";
+        int tempFd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (tempFd < 0) {
+            return false;
+        }
+
+        vector<char> page(headerSize, 0);
+        StoreHeader packed = header();
+        packed.capacity = capacity;
+        packed.highWater = packed.liveCount;
+        packed.freeHead = -1;
+        memcpy(page.data(), &packed, sizeof(packed));
+        bool ok = writeAll(tempFd, page.data(), page.size());
+
+        vector<ContactRecord> batch;
+        batch.reserve(1024);
+        for (uint64_t slot = 0; ok && slot <= slotCount(); ++slot) {
+            if (slot == slotCount() || batch.size() == batch.capacity()) {
+                ok = writeAll(tempFd, (const char*)batch.data(), batch.size() * sizeof(ContactRecord));
+                batch.clear();
+            }
+            if (slot < slotCount() && isLive(slot)) {
+                batch.push_back(slotAt(slot));
+            }
+        }
+        ok = ok && ftruncate(tempFd, headerSize + capacity * sizeof(ContactRecord)) == 0 && fsync(tempFd) == 0;
+        close(tempFd);
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+            unlink(tempPath.c_str());
+            return false;
+        }
+
+        // Make the rename itself durable before dropping the old file.
+        size_t slash = path.rfind('/');
+        int dirFd = open(slash == string::npos ? "." : path.substr(0, slash + 1).c_str(), O_RDONLY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+        close(fd);
+        fd = open(path.c_str(), O_RDWR);
+        if (fd < 0 || !map(capacity)) {
+            base.store(nullptr);
+        }
+        unmapRetired();
+        return base.load() != nullptr;
+    }
+
+    void replayLog() {
+        WalEntry entry;
+        size_t applied = 0;
+        lseek(walFd, 0, SEEK_SET);
+        while (read(walFd, &entry, sizeof(entry)) == (ssize_t)sizeof(entry)) {
+            // A torn or corrupt entry marks the end of what was committed.
+            if (entry.magic != walMagic ||
+                entry.crc != crc32((const char*)&entry + sizeof(entry.crc), sizeof(entry) - sizeof(entry.crc)) ||
+                !ensureCapacity(entry.slot)) {
+                break;
+            }
+            apply(entry);
+            ++applied;
+        }
+        unmapRetired();
+        if (applied > 0) {
+            cerr << "Recovered " << applied << " logged change(s).\n";
+        }
+        checkpoint();
+    }
+
+    void checkpointIfLogIsLarge() {
+        if (lseek(walFd, 0, SEEK_END) >= walCheckpointSize) {
+            checkpoint();
+        }
+    }
+
+public:
+    ContactStore(const string& path) : path(path), walPath(path + ".wal") {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        walFd = open(walPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0 || walFd < 0) {
+            cerr << "Error opening contact store.\n";
+            return;
+        }
+        // The log is never replaced (compaction renames the data file), so
+        // its lock keeps a second process out for as long as this one runs.
+        if (flock(walFd, LOCK_EX | LOCK_NB) != 0) {
+            cerr << "Error: " << path << " is in use by another process.\n";
+            return;
+        }
+
+        struct stat info;
+        fstat(fd, &info);
+        if (info.st_size == 0) {
+            if (ftruncate(fd, headerSize + initialCapacity * sizeof(ContactRecord)) != 0 || !map(initialCapacity)) {
+                return;
+            }
+            StoreHeader& h = header();
+            memcpy(h.magic, storeMagic, sizeof(storeMagic));
+            h.version = storeVersion;
+            h.recordSize = sizeof(ContactRecord);
+            h.capacity = initialCapacity;
+            h.highWater = 0;
+            h.liveCount = 0;
+            h.freeHead = -1;
+        }
+        else {
+            StoreHeader existing;
+            if (info.st_size < (off_t)headerSize || pread(fd, &existing, sizeof(existing), 0) != (ssize_t)sizeof(existing) ||
+                memcmp(existing.magic, storeMagic, sizeof(storeMagic)) != 0 || existing.version != storeVersion ||
+                existing.recordSize != sizeof(ContactRecord) ||
+                (uint64_t)info.st_size < headerSize + existing.capacity * sizeof(ContactRecord)) {
+                cerr << "Error: " << path << " is not a valid contact store.\n";
+                return;
+            }
+            if (!map(existing.capacity)) {
+                return;
+            }
+        }
+        replayLog();
+        if (header().highWater > initialCapacity && header().liveCount < header().highWater / 2 && !compact()) {
+            cerr << "Error compacting contact store.\n";
+            if (!base.load()) {
+                return;
+            }
+        }
+
+        Indexes& side = sides[0];
+        side.ids.reserve(size());
+        side.phones.reserve(size());
+        side.names.reserve(size());
+        for (uint64_t slot = 0; slot < slotCount(); ++slot) {
+            if (isLive(slot)) {
+                side.ids.insert((uint32_t)slotAt(slot).id, slot);
+                side.phones.insert(phoneHash(phone(slot)), slot);
+                side.names.push_back(nameEntry(slot));
+            }
+        }
+        sortNames(side.names.begin(), side.names.end());
+        sides[1] = side;
+    }
+
+    ~ContactStore() {
+        if (base.load()) {
+            checkpoint();
+            munmap(base.load(), mappedSize);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (walFd >= 0) {
+            close(walFd);
+        }
+    }
+
+    bool isOpen() const {
+        return base.load() != nullptr;
+    }
+
+    // Flushes the mapping to disk; after that the log is no longer needed.
+    void checkpoint() {
+        if (msync(base.load(), mappedSize, MS_SYNC) == 0 && ftruncate(walFd, 0) == 0) {
+            fdatasync(walFd);
+        }
+    }
+
+    // The slot-level accessors below read the mapping and the indexes
+    // directly. They are for a single thread that also makes the changes;
+    // other threads use the lookups further down, which copy contacts out.
+    uint64_t size() const {
+        return header().liveCount;
+    }
+
+    uint64_t slotCount() const {
+        return header().highWater;
+    }
+
+    bool isLive(uint64_t slot) const {
+        return slotAt(slot).live != 0;
+    }
+
+    int id(uint64_t slot) const {
+        return slotAt(slot).id;
+    }
+
+    // Views into the mapping; valid until the next insert, which may remap.
+    string_view name(uint64_t slot) const {
+        return string_view(slotAt(slot).name, slotAt(slot).nameLength);
+    }
+
+    string_view phone(uint64_t slot) const {
+        return string_view(slotAt(slot).phone, slotAt(slot).phoneLength);
+    }
+
+    Contact get(uint64_t slot) const {
+        return Contact(id(slot), name(slot), phone(slot));
+    }
+
+    int64_t findSlot(int id) const {
+        return findSlot(sides[readSide.load()], id);
+    }
+
+    vector<uint64_t> findByPhone(const string& phoneNumber) const {
+        return findByPhone(sides[readSide.load()], phoneNumber);
+    }
+
+    // Every live slot, ordered by name ignoring case.
+    vector<uint64_t> slotsByName() const {
+        vector<uint64_t> slots;
+        for (const NameEntry& entry : sides[readSide.load()].names) {
+            slots.push_back(entry.slot);
+        }
+        return slots;
+    }
+
+    // Slots of up to limit contacts whose name starts with prefix, ignoring
+    // case, in name order.
+    vector<uint64_t> findByNamePrefix(const string& prefix, size_t limit) const {
+        return findByNamePrefix(sides[readSide.load()], prefix, limit);
+    }
+
+    // Lookups that are safe on any thread, concurrently with changes.
+    size_t count() const {
+        ReadGuard guard(*this);
+        return guard.indexes().ids.size();
+    }
+
+    bool lookup(int id, Contact& contact) const {
+        ReadGuard guard(*this);
+        int64_t slot = findSlot(guard.indexes(), id);
+        if (slot < 0) {
+            return false;
+        }
+        contact = get(slot);
+        return true;
+    }
+
+    vector<Contact> lookupPhone(const string& phoneNumber) const {
+        ReadGuard guard(*this);
+        vector<Contact> contacts;
+        for (uint64_t slot : findByPhone(guard.indexes(), phoneNumber)) {
+            contacts.push_back(get(slot));
+        }
+        return contacts;
+    }
+
+    vector<Contact> lookupNamePrefix(const string& prefix, size_t limit) const {
+        ReadGuard guard(*this);
+        vector<Contact> contacts;
+        for (uint64_t slot : findByNamePrefix(guard.indexes(), prefix, limit)) {
+            contacts.push_back(get(slot));
+        }
+        return contacts;
+    }
+
+    // Applies changes in order with one log write and sync (group commit)
+    // and sets ok on each. An insert fails if its id is taken or a field is
+    // too long, an erase if the id is missing. Slots freed here are only
+    // reused by a later group, once no reader can reach them any more, so
+    // once the group has erased something its inserts take fresh slots.
+    void apply(vector<ContactChange>& changes) {
+        lock_guard<mutex> lock(writeLock);
+        const Indexes& current = sides[readSide.load()];
+        uint64_t highWater = header().highWater;
+        uint64_t liveCount = header().liveCount;
+        int64_t freeHead = header().freeHead;
+        unordered_map<int, int64_t> touched;  // id -> slot, or -1 once erased here
+        vector<WalEntry> entries;
+        vector<size_t> applied;
+        bool erased = false;
+
+        for (size_t i = 0; i < changes.size(); ++i) {
+            ContactChange& change = changes[i];
+            change.ok = false;
+            auto seen = touched.find(change.id);
+            int64_t slot = seen != touched.end() ? seen->second : findSlot(current, change.id);
+            WalEntry entry = {};
+            if (change.insert) {
+                if (slot >= 0 || change.name.size() > maxNameLength || change.phoneNumber.size() > maxPhoneLength) {
+                    continue;
+                }
+                if (freeHead >= 0 && !erased) {
+                    slot = freeHead;
+                    freeHead = slotAt(slot).nextFree;
+                }
+                else {
+                    slot = highWater++;
+                    if (!ensureCapacity(slot)) {
+                        --highWater;
+                        break;
+                    }
+                }
+                ++liveCount;
+                fill(entry.record, change.id, change.name, change.phoneNumber);
+            }
+            else {
+                if (slot < 0) {
+                    continue;
+                }
+                --liveCount;
+                entry.record.nextFree = freeHead;
+                freeHead = slot;
+                erased = true;
+            }
+            entry.slot = slot;
+            entry.highWater = highWater;
+            entry.liveCount = liveCount;
+            entry.freeHead = freeHead;
+            entries.push_back(entry);
+            applied.push_back(i);
+            touched[change.id] = change.insert ? slot : -1;
+        }
+        if (entries.empty() || !log(entries.data(), entries.size())) {
+            // ensureCapacity may have remapped while readers were running.
+            if (!retiredMappings.empty()) {
+                waitForReaders();
+                unmapRetired();
+            }
+            return;
+        }
+
+        // New records go in before the indexes point readers at them; erased
+        // ones are cleared only after readers can no longer reach them. Live
+        // records are never written again once published.
+        for (const WalEntry& entry : entries) {
+            if (entry.record.live) {
+                slotAt(entry.slot) = entry.record;
+            }
+        }
+        publish([&](Indexes& side) {
+            settleNames(side);
+            for (const WalEntry& entry : entries) {
+                if (entry.record.live) {
+                    index(side, entry.slot);
+                }
+                else {
+                    unindex(side, entry.slot);
+                }
+            }
+        });
+        for (const WalEntry& entry : entries) {
+            if (!entry.record.live) {
+                slotAt(entry.slot) = entry.record;
+            }
+        }
+        const WalEntry& last = entries.back();
+        header().highWater = last.highWater;
+        header().liveCount = last.liveCount;
+        header().freeHead = last.freeHead;
+        for (size_t i : applied) {
+            changes[i].ok = true;
+        }
+        checkpointIfLogIsLarge();
+    }
+
+    bool insert(int id, string_view name, string_view phoneNumber) {
+        vector<ContactChange> changes = { ContactChange{ true, id, string(name), string(phoneNumber) } };
+        apply(changes);
+        return changes[0].ok;
+    }
+
+    bool remove(int id) {
+        vector<ContactChange> changes = { ContactChange{ false, id, "", "" } };
+        apply(changes);
+        return changes[0].ok;
+    }
+
+    // Bulk insert for imports. The records are written to never-used slots
+    // above the high-water mark, which nothing reads, and synced there; one
+    // log entry then moves the high-water mark over all of them. A crash
+    // leaves either none or all of the batch visible. Free slots are not
+    // reused here; compaction reclaims them. The caller checks ids and
+    // lengths, and calls settleNames once the import is done: until then
+    // the batch is found by id and phone but not by name.
+    bool appendBatch(const vector<Contact>& contacts) {
+        if (contacts.empty()) {
+            return true;
+        }
+        lock_guard<mutex> lock(writeLock);
+        uint64_t first = slotCount();
+        uint64_t last = first + contacts.size() - 1;
+        if (!ensureCapacity(last)) {
+            return false;
+        }
+        for (size_t i = 0; i < contacts.size(); ++i) {
+            fill(slotAt(first + i), contacts[i].id, contacts[i].name, contacts[i].phoneNumber);
+        }
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t begin = (headerSize + first * sizeof(ContactRecord)) & ~(pageSize - 1);
+        size_t end = headerSize + (last + 1) * sizeof(ContactRecord);
+        if (msync(base.load() + begin, end - begin, MS_SYNC) != 0) {
+            cerr << "Error writing contact store.\n";
+            return false;
+        }
+
+        WalEntry entry = {};
+        entry.slot = last;
+        entry.record = slotAt(last);
+        entry.highWater = last + 1;
+        entry.liveCount = header().liveCount + contacts.size();
+        entry.freeHead = header().freeHead;
+        if (!log(&entry, 1)) {
+            return false;
+        }
+        apply(entry);
+        publish([&](Indexes& side) {
+            side.ids.reserve(entry.liveCount);
+            side.phones.reserve(entry.liveCount);
+            for (uint64_t slot = first; slot <= last; ++slot) {
+                side.ids.insert((uint32_t)slotAt(slot).id, slot);
+                side.phones.insert(phoneHash(phone(slot)), slot);
+                side.pendingNames.push_back(nameEntry(slot));
+            }
+        });
+        checkpointIfLogIsLarge();
+        return true;
+    }
+
+    void settleNames() {
+        lock_guard<mutex> lock(writeLock);
+        publish([&](Indexes& side) { settleNames(side); });
+    }
+};
+
+bool endsWith(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool parseId(const string& text, int& id) {
+    size_t used = 0;
+    try {
+        long value = stol(text, &used);
+        if (used != text.size() || value < numeric_limits<int>::min() || value > numeric_limits<int>::max()) {
+            return false;
+        }
+        id = (int)value;
+        return true;
+    }
+    catch (const exception&) {
+        return false;
+    }
+}
+
+// Reads one CSV record (RFC 4180: fields may be quoted, with "" for a quote
+// and line breaks inside quotes). line counts physical lines read so far.
+bool readCsvRecord(istream& in, vector<string>& fields, size_t& line) {
+    string text;
+    if (!getline(in, text)) {
+        return false;
+    }
+    ++line;
+    fields.assign(1, string());
+    bool quoted = false;
+    for (size_t i = 0;; ++i) {
+        if (i == text.size()) {
+            if (!quoted) {
+                break;
+            }
+            if (!getline(in, text)) {
+                break;
+            }
+            ++line;
+            fields.back() += '\n';
+            i = (size_t)-1;
+            continue;
+        }
+        char c = text[i];
+        if (quoted) {
+            if (c != '"') {
+                fields.back() += c;
+            }
+            else if (i + 1 < text.size() && text[i + 1] == '"') {
+                fields.back() += '"';
+                ++i;
+            }
+            else {
+                quoted = false;
+            }
+        }
+        else if (c == '"') {
+            quoted = true;
+        }
+        else if (c == ',') {
+            fields.emplace_back();
+        }
+        else if (c != '\r' || i + 1 != text.size()) {
+            fields.back() += c;
+        }
+    }
+    return true;
+}
+
+// Pulls flat objects one at a time out of a JSON array of objects, or out
+// of newline-delimited JSON. Values must be strings, numbers, true, false or
+// null; anything nested is rejected.
+class JsonObjectReader {
+private:
+    istream& in;
+    size_t lineNumber = 1;
+
+    int next() {
+        int c = in.get();
+        if (c == '\n') {
+            ++lineNumber;
+        }
+        return c;
+    }
+
+    int skipSpace() {
+        int c = next();
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            c = next();
+        }
+        return c;
+    }
+
+    static void appendUtf8(string& text, uint32_t code) {
+        if (code < 0x80) {
+            text += (char)code;
+        }
+        else if (code < 0x800) {
+            text += (char)(0xC0 | (code >> 6));
+            text += (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000) {
+            text += (char)(0xE0 | (code >> 12));
+            text += (char)(0x80 | ((code >> 6) & 0x3F));
+            text += (char)(0x80 | (code & 0x3F));
+        }
+        else {
+            text += (char)(0xF0 | (code >> 18));
+            text += (char)(0x80 | ((code >> 12) & 0x3F));
+            text += (char)(0x80 | ((code >> 6) & 0x3F));
+            text += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool readHex(uint32_t& code) {
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            int c = next();
+            if (!isxdigit(c)) {
+                return false;
+            }
+            code = code * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+        }
+        return true;
+    }
+
+    // Called after the opening quote.
+    bool readString(string& text) {
+        text.clear();
+        for (int c = next(); c != '"'; c = next()) {
+            if (c == EOF || c == '\n') {
+                return false;
+            }
+            if (c != '\\') {
+                text += (char)c;
+                continue;
+            }
+            c = next();
+            uint32_t code;
+            switch (c) {
+            case '"': case '\\': case '/': text += (char)c; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'u':
+                if (!readHex(code)) {
+                    return false;
+                }
+                if (code >= 0xD800 && code < 0xDC00) {
+                    uint32_t low;
+                    if (next() != '\\' || next() != 'u' || !readHex(low) || low < 0xDC00 || low >= 0xE000) {
+                        return false;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(text, code);
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Reads a number or literal starting with first.
+    bool readScalar(int first, string& text) {
+        text.assign(1, (char)first);
+        while (isalnum(in.peek()) || in.peek() == '.' || in.peek() == '-' || in.peek() == '+') {
+            text += (char)next();
+        }
+        if (text == "true" || text == "false" || text == "null") {
+            return true;
+        }
+        size_t used = 0;
+        try {
+            stod(text, &used);
+        }
+        catch (const exception&) {
+            return false;
+        }
+        return used == text.size();
+    }
+
+public:
+    JsonObjectReader(istream& in) : in(in) {}
+
+    size_t line() const {
+        return lineNumber;
+    }
+
+    // Returns false at the end of input; error is set if the input is
+    // malformed, and reading cannot continue after that.
+    bool nextObject(vector<pair<string, string>>& fields, string& error) {
+        fields.clear();
+        int c = skipSpace();
+        while (c == '[' || c == ',' || c == ']') {
+            c = skipSpace();
+        }
+        if (c == EOF) {
+            return false;
+        }
+        if (c != '{') {
+            error = "expected an object";
+            return false;
+        }
+        c = skipSpace();
+        while (c != '}') {
+            string key;
+            string value;
+            if (c != '"' || !readString(key) || skipSpace() != ':') {
+                error = "expected a quoted key and ':'";
+                return false;
+            }
+            c = skipSpace();
+            if (c == '"' ? !readString(value) : (c == '{' || c == '[' || c == EOF || !readScalar(c, value))) {
+                error = "unsupported value for \"" + key + "\"";
+                return false;
+            }
+            fields.emplace_back(key, value == "null" && c != '"' ? string() : value);
+            c = skipSpace();
+            if (c == ',') {
+                c = skipSpace();
+            }
+            else if (c != '}') {
+                error = "expected ',' or '}'";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+void writeCsvField(string& out, string_view field) {
+    bool quote = field.find_first_of(",\"\r\n") != string_view::npos ||
+        (!field.empty() && (field.front() == ' ' || field.back() == ' '));
+    if (!quote) {
+        out += field;
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+void writeJsonString(string& out, string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n') {
+            out += "\\n";
+        }
+        else if (c == '\t') {
+            out += "\\t";
+        }
+        else if ((unsigned char)c < 0x20) {
+            out += "\\u00";
+            out += hex[(unsigned char)c >> 4];
+            out += hex[c & 0xF];
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// Names are compared lower-cased, with punctuation and repeated spaces
+// folded into single spaces.
+string normalizeName(string_view name) {
+    string folded;
+    for (char c : name) {
+        if (isalnum((unsigned char)c) || (unsigned char)c >= 0x80) {
+            folded += (char)tolower((unsigned char)c);
+        }
+        else if (!folded.empty() && folded.back() != ' ') {
+            folded += ' ';
+        }
+    }
+    if (!folded.empty() && folded.back() == ' ') {
+        folded.pop_back();
+    }
+    return folded;
+}
+
+// Levenshtein distance between a and b, or limit + 1 once it is known to be
+// larger than limit. Only the diagonal band of width 2 * limit + 1 is
+// filled. Both names are at most maxNameLength bytes, so the rows live on
+// the stack.
+size_t boundedDistance(const string& a, const string& b, size_t limit) {
+    size_t n = a.size();
+    size_t m = b.size();
+    if ((n > m ? n - m : m - n) > limit || m > maxNameLength) {
+        return limit + 1;
+    }
+    const size_t far = limit + 1;
+    size_t rows[2][maxNameLength + 1];
+    size_t* previous = rows[0];
+    size_t* current = rows[1];
+    for (size_t j = 0; j <= m; ++j) {
+        previous[j] = min(j, far);
+    }
+    for (size_t i = 1; i <= n; ++i) {
+        size_t from = i > limit ? i - limit : 1;
+        size_t to = min(m, i + limit);
+        current[0] = min(i, far);
+        if (from > 1) {
+            current[from - 1] = far;
+        }
+        size_t best = from == 1 ? current[0] : far;
+        for (size_t j = from; j <= to; ++j) {
+            size_t cost = previous[j - 1] + (a[i - 1] != b[j - 1]);
+            cost = min(cost, min(previous[j], current[j - 1]) + 1);
+            current[j] = min(cost, far);
+            best = min(best, current[j]);
+        }
+        if (to < m) {
+            current[to + 1] = far;
+        }
+        if (best > limit) {
+            return far;
+        }
+        swap(previous, current);
+    }
+    return previous[m];
+}
+
+// Groups contacts that look like the same person: the same phone number
+// after normalization and names at most one edit apart (two for names over
+// ten characters), or no phone number and the same normalized name. Since a
+// shared number is required, a chain of similar names cannot pull different
+// people into one group. Candidate pairs come from two blockings, each
+// scanned by threads over a sorted order: neighbours by name, and neighbours
+// by name within the same phone number. Returns the groups of two or more,
+// as slots ordered by id.
+vector<vector<uint64_t>> findDuplicateContacts(const ContactStore& store, size_t threads) {
+    struct Key {
+        string name;
+        string phone;
+        uint64_t phoneKey;
+        uint64_t slot;
+    };
+    const size_t window = 16;
+
+    vector<uint64_t> slots = store.slotsByName();
+    size_t count = slots.size();
+    threads = max<size_t>(1, min(threads, count / 1024 + 1));
+
+    // Splits [0, total) into one contiguous range per thread.
+    auto parallel = [&](size_t total, auto work) {
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back(work, t, total * t / threads, total * (t + 1) / threads);
+        }
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    };
+
+    vector<Key> keys(count);
+    parallel(count, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            keys[i] = Key{ normalizeName(store.name(slots[i])), normalizePhone(store.phone(slots[i])),
+                phoneHash(store.phone(slots[i])), slots[i] };
+        }
+    });
+
+    auto similar = [&](const Key& a, const Key& b) {
+        if (a.phone != b.phone) {
+            return false;
+        }
+        if (a.phone.empty()) {
+            return a.name == b.name;
+        }
+        size_t limit = max(a.name.size(), b.name.size()) > 10 ? 2 : 1;
+        return boundedDistance(a.name, b.name, limit) <= limit;
+    };
+
+    vector<vector<pair<uint32_t, uint32_t>>> edges(threads);
+    auto scan = [&](const vector<uint32_t>& order, bool samePhone) {
+        parallel(order.size(), [&](size_t t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const Key& a = keys[order[i]];
+                for (size_t j = i + 1; j < order.size() && j <= i + window; ++j) {
+                    const Key& b = keys[order[j]];
+                    if (samePhone && b.phoneKey != a.phoneKey) {
+                        break;
+                    }
+                    if (similar(a, b)) {
+                        edges[t].emplace_back(order[i], order[j]);
+                    }
+                }
+            }
+        });
+    };
+
+    // The store's name index already gives the name order.
+    vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = (uint32_t)i;
+    }
+    scan(order, false);
+
+    // Phone blocking catches typos early in the name, which the name order
+    // spreads apart. Sorting by phone hash, then name position, keeps each
+    // number's contacts together and in name order.
+    vector<pair<uint64_t, uint32_t>> byPhone;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!keys[i].phone.empty()) {
+            byPhone.emplace_back(keys[i].phoneKey, i);
+        }
+    }
+    sort(byPhone.begin(), byPhone.end());
+    order.clear();
+    for (const auto& entry : byPhone) {
+        order.push_back(entry.second);
+    }
+    scan(order, true);
+
+    vector<uint32_t> parent(count);
+    for (size_t i = 0; i < count; ++i) {
+        parent[i] = (uint32_t)i;
+    }
+    auto root = [&](uint32_t i) {
+        while (parent[i] != i) {
+            i = parent[i] = parent[parent[i]];
+        }
+        return i;
+    };
+    for (const auto& threadEdges : edges) {
+        for (const auto& edge : threadEdges) {
+            parent[root(edge.first)] = root(edge.second);
+        }
+    }
+
+    vector<vector<uint64_t>> groups(count);
+    for (size_t i = 0; i < count; ++i) {
+        groups[root((uint32_t)i)].push_back(keys[i].slot);
+    }
+    vector<vector<uint64_t>> clusters;
+    for (auto& group : groups) {
+        if (group.size() > 1) {
+            sort(group.begin(), group.end(), [&](uint64_t a, uint64_t b) { return store.id(a) < store.id(b); });
+            clusters.push_back(move(group));
+        }
+    }
+    return clusters;
+}
+
+// Thread-safe front end for a ContactStore shared by many clients. Lookups
+// go straight to the store, which never blocks them. Changes are queued for
+// one writer thread, which commits everything that queued up while the
+// previous group was syncing as the next group, so concurrent writers share
+// a log sync.
+class ContactService {
 private:
-    vector<Contact> contacts;
-    const string fileName = "contacts.txt";
+    struct Request {
+        ContactChange change;
+        promise<bool> done;
+    };
 
-    void saveContacts() {
-        ofstream file(fileName, ofstream::trunc);
-        if (!file.is_open()) {
-            cerr << "Error opening file for writing.\n";
-            return;
+    ContactStore& store;
+    mutex queueLock;
+    condition_variable queued;
+    vector<Request*> queue;
+    bool stopping = false;
+    thread writer;
+
+    void run() {
+        vector<Request*> group;
+        while (true) {
+            {
+                unique_lock<mutex> lock(queueLock);
+                queued.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                group.swap(queue);
+            }
+            vector<ContactChange> changes;
+            changes.reserve(group.size());
+            for (Request* request : group) {
+                changes.push_back(move(request->change));
+            }
+            store.apply(changes);
+            for (size_t i = 0; i < group.size(); ++i) {
+                group[i]->done.set_value(changes[i].ok);
+            }
+            group.clear();
         }
-        for (const auto& contact : contacts) {
-            file << contact.id << endl;
-            file << contact.name << endl;
-            file << contact.phoneNumber << endl;
+    }
+
+    bool submit(ContactChange change) {
+        Request request{ move(change), promise<bool>() };
+        future<bool> done = request.done.get_future();
+        {
+            lock_guard<mutex> lock(queueLock);
+            queue.push_back(&request);
         }
-        file.close();
+        queued.notify_one();
+        return done.get();
+    }
+
+public:
+    ContactService(ContactStore& store) : store(store), writer(&ContactService::run, this) {}
+
+    ~ContactService() {
+        {
+            lock_guard<mutex> lock(queueLock);
+            stopping = true;
+        }
+        queued.notify_one();
+        writer.join();
+    }
+
+    bool add(int id, const string& name, const string& phoneNumber) {
+        return submit(ContactChange{ true, id, name, phoneNumber });
+    }
+
+    bool remove(int id) {
+        return submit(ContactChange{ false, id, "", "" });
+    }
+
+    bool lookup(int id, Contact& contact) const {
+        return store.lookup(id, contact);
+    }
+
+    vector<Contact> lookupPhone(const string& phoneNumber) const {
+        return store.lookupPhone(phoneNumber);
+    }
+
+    vector<Contact> lookupNamePrefix(const string& prefix, size_t limit) const {
+        return store.lookupNamePrefix(prefix, limit);
+    }
+
+    size_t count() const {
+        return store.count();
+    }
+};
+
+// Line protocol spoken on the server socket. Each request is one line; the
+// command is followed by a space and its arguments, which are separated by
+// tabs. Each reply starts with OK or ERR.
+//
+//   GET id                       OK id<TAB>name<TAB>phone
+//   ADD id<TAB>name<TAB>phone    OK
+//   DEL id                       OK
+//   PHONE number                 OK n, then n lines id<TAB>name<TAB>phone
+//   PREFIX text                  same, at most serverSearchLimit contacts by name
+//   COUNT                        OK n
+const size_t serverSearchLimit = 100;
+
+void appendContact(string& out, const Contact& contact) {
+    out += to_string(contact.id);
+    out += '\t';
+    out += contact.name;
+    out += '\t';
+    out += contact.phoneNumber;
+    out += '\n';
+}
+
+string handleRequest(ContactService& service, const string& line) {
+    size_t space = line.find(' ');
+    string command = line.substr(0, space);
+    string argument = space == string::npos ? "" : line.substr(space + 1);
+    int id;
+
+    if (command == "GET") {
+        Contact contact(0, "", "");
+        if (!parseId(argument, id) || !service.lookup(id, contact)) {
+            return "ERR not found\n";
+        }
+        string reply = "OK ";
+        appendContact(reply, contact);
+        return reply;
+    }
+    if (command == "ADD") {
+        size_t first = argument.find('\t');
+        size_t second = first == string::npos ? first : argument.find('\t', first + 1);
+        if (second == string::npos || argument.find('\t', second + 1) != string::npos ||
+            !parseId(argument.substr(0, first), id)) {
+            return "ERR expected ADD id<TAB>name<TAB>phone\n";
+        }
+        string name = argument.substr(first + 1, second - first - 1);
+        string phoneNumber = argument.substr(second + 1);
+        if (name.empty() || name.size() > maxNameLength || phoneNumber.size() > maxPhoneLength) {
+            return "ERR invalid name or phone number\n";
+        }
+        return service.add(id, name, phoneNumber) ? "OK\n" : "ERR duplicate id\n";
+    }
+    if (command == "DEL") {
+        return parseId(argument, id) && service.remove(id) ? "OK\n" : "ERR not found\n";
+    }
+    if (command == "PHONE" || command == "PREFIX") {
+        vector<Contact> contacts = command == "PHONE" ? service.lookupPhone(argument)
+                                                      : service.lookupNamePrefix(argument, serverSearchLimit);
+        string reply = "OK " + to_string(contacts.size()) + "\n";
+        for (const Contact& contact : contacts) {
+            appendContact(reply, contact);
+        }
+        return reply;
+    }
+    if (command == "COUNT") {
+        return "OK " + to_string(service.count()) + "\n";
+    }
+    return "ERR unknown command\n";
+}
+
+bool sendAll(int socket, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
     }
+    return true;
+}
+
+// Answers requests from one client until it disconnects. Replies to
+// pipelined requests are sent together, once the buffered input runs out.
+// The caller closes the socket.
+void serveClient(ContactService& service, int client) {
+    string input;
+    string output;
+    char buffer[65536];
+    while (true) {
+        ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        input.append(buffer, n);
+        size_t start = 0;
+        for (size_t end; (end = input.find('\n', start)) != string::npos; start = end + 1) {
+            string line = input.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            output += handleRequest(service, line);
+        }
+        input.erase(0, start);
+        if (!output.empty() && !sendAll(client, output)) {
+            break;
+        }
+        output.clear();
+    }
+}
+
+volatile sig_atomic_t stopServer = 0;
+
+void requestStop(int) {
+    stopServer = 1;
+}
+
+// Serves the store on a Unix socket at socketPath, one detached thread per
+// client, until SIGINT or SIGTERM. A client thread takes its socket out of
+// the open set and closes it under clientsLock, so at shutdown only sockets
+// that are still open are shut down, and the wait ends once the last
+// thread is done with service.
+bool serveContacts(ContactStore& store, const string& socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: socket path is too long: " << socketPath << endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        cerr << "Error: Could not listen on " << socketPath << endl;
+        if (listener >= 0) {
+            close(listener);
+        }
+        return false;
+    }
+
+    // No SA_RESTART, so a signal interrupts accept.
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    ContactService service(store);
+    mutex clientsLock;
+    condition_variable clientsDone;
+    unordered_set<int> openClients;
+    cout << "Serving " << store.count() << " contacts on " << socketPath << endl;
+    while (!stopServer) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            cerr << "Error accepting connection: " << strerror(errno) << endl;
+            break;
+        }
+        {
+            lock_guard<mutex> lock(clientsLock);
+            openClients.insert(client);
+        }
+        thread([&, client] {
+            serveClient(service, client);
+            lock_guard<mutex> lock(clientsLock);
+            openClients.erase(client);
+            close(client);
+            clientsDone.notify_all();
+        }).detach();
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    {
+        unique_lock<mutex> lock(clientsLock);
+        for (int client : openClients) {
+            shutdown(client, SHUT_RDWR);
+        }
+        clientsDone.wait(lock, [&] { return openClients.empty(); });
+    }
+    cout << "Server stopped." << endl;
+    return true;
+}
+
+class ContactManager {
+private:
+    ContactStore store;
+    const string fileName = "contacts.txt";
+    const size_t searchLimit = 20;
+    const size_t importBatchSize = 65536;
+    const size_t exportBufferSize = 1 << 20;
+    const size_t maxReportedErrors = 10;
 
     bool isUniqueId(int id) {
-        return find_if(contacts.begin(), contacts.end(), [id](const Contact& c) { return c.id == id; }) == contacts.end();
+        return store.findSlot(id) < 0;
     }
 
     int getValidatedId() {
@@ -59,14 +1788,19 @@ private:
     }
 
 public:
-    ContactManager() {
-        loadContacts();
+    ContactManager() : store("contacts.db") {
+        if (!store.isOpen()) {
+            exit(1);
+        }
+        if (store.slotCount() == 0) {
+            loadContacts();
+        }
     }
 
+    // Imports the old line-oriented contacts.txt into a new store.
     void loadContacts() {
         ifstream file(fileName);
         if (!file.is_open()) {
-            cerr << "Error opening file for reading.\n";
             return;
         }
 
@@ -74,7 +1808,15 @@ public:
         string name;
         string phoneNumber;
         while (file >> id >> ws && getline(file, name) && getline(file, phoneNumber)) {
-            contacts.emplace_back(id, name, phoneNumber);
+            if (!name.empty() && name.back() == '\r') {
+                name.pop_back();
+            }
+            if (!phoneNumber.empty() && phoneNumber.back() == '\r') {
+                phoneNumber.pop_back();
+            }
+            if (!store.insert(id, name, phoneNumber)) {
+                cerr << "Skipping contact " << id << " from " << fileName << ".\n";
+            }
         }
         file.close();
     }
@@ -88,20 +1830,49 @@ public:
         cout << "Enter contact phone number: ";
         getline(cin, phoneNumber);
 
-        contacts.emplace_back(id, name, phoneNumber);
-        saveContacts();
-        cout << "Contact added successfully.";
+        if (name.size() > maxNameLength || phoneNumber.size() > maxPhoneLength) {
+            cout << "Name or phone number is too long (at most " << maxNameLength << " and " << maxPhoneLength
+                 << " characters).";
+        }
+        else if (store.insert(id, name, phoneNumber)) {
+            cout << "Contact added successfully.";
+        }
         pressAnyKeyToContinue();
     }
 
     void viewContacts() {
-        if (contacts.empty()) {
+        if (store.size() == 0) {
             cout << "No contacts available.\n";
         }
         else {
             cout << setw(5) << "ID" << setw(20) << "Name" << setw(20) << "Phone Number" << endl;
-            for (const auto& contact : contacts) {
-                cout << setw(5) << contact.id << setw(20) << contact.name << setw(20) << contact.phoneNumber << endl;
+            for (uint64_t slot = 0; slot < store.slotCount(); ++slot) {
+                if (!store.isLive(slot)) {
+                    continue;
+                }
+                cout << setw(5) << store.id(slot) << setw(20) << store.name(slot) << setw(20) << store.phone(slot) << endl;
+            }
+        }
+        pressAnyKeyToContinue();
+    }
+
+    // A query starting with a digit or '+' is looked up as a phone number,
+    // anything else as the start of a name.
+    void searchContacts() {
+        string query;
+        cout << "Enter name prefix or phone number: ";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, query);
+
+        bool byPhone = !query.empty() && (isdigit((unsigned char)query[0]) || query[0] == '+');
+        vector<uint64_t> slots = byPhone ? store.findByPhone(query) : store.findByNamePrefix(query, searchLimit);
+        if (slots.empty()) {
+            cout << "No matching contacts.\n";
+        }
+        else {
+            cout << setw(5) << "ID" << setw(20) << "Name" << setw(20) << "Phone Number" << endl;
+            for (uint64_t slot : slots) {
+                cout << setw(5) << store.id(slot) << setw(20) << store.name(slot) << setw(20) << store.phone(slot) << endl;
             }
         }
         pressAnyKeyToContinue();
@@ -112,10 +1883,7 @@ public:
         cout << "Enter contact ID to delete: ";
         cin >> id;
 
-        auto it = remove_if(contacts.begin(), contacts.end(), [id](const Contact& c) { return c.id == id; });
-        if (it != contacts.end()) {
-            contacts.erase(it, contacts.end());
-            saveContacts();
+        if (store.remove(id)) {
             cout << "Contact deleted successfully.";
         }
         else {
@@ -124,6 +1892,233 @@ public:
         pressAnyKeyToContinue();
     }
 
+    // Streams a CSV file (id,name,phone with an optional header row) or a
+    // JSON file (objects with id, name and phone) into the store, committing
+    // every importBatchSize contacts. Rows with a bad or duplicate id, no
+    // name or an over-long field are reported and skipped.
+    bool importContacts(const string& path) {
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) {
+            cerr << "Error: Could not open the file " << path << endl;
+            return false;
+        }
+
+        vector<Contact> batch;
+        unordered_set<int> batchIds;
+        size_t imported = 0;
+        size_t rejected = 0;
+        bool ok = true;
+
+        auto reject = [&](size_t line, const string& reason) {
+            if (++rejected <= maxReportedErrors) {
+                cerr << path << ":" << line << ": " << reason << "\n";
+            }
+        };
+        auto flush = [&]() {
+            if (!store.appendBatch(batch)) {
+                return false;
+            }
+            imported += batch.size();
+            batch.clear();
+            batchIds.clear();
+            return true;
+        };
+        auto add = [&](size_t line, const string& idText, const string& name, const string& phoneNumber) {
+            int id;
+            if (!parseId(idText, id)) {
+                reject(line, "invalid id \"" + idText + "\"");
+            }
+            else if (!isUniqueId(id) || !batchIds.insert(id).second) {
+                reject(line, "duplicate id " + idText);
+            }
+            else if (name.empty()) {
+                reject(line, "missing name");
+            }
+            else if (name.size() > maxNameLength || phoneNumber.size() > maxPhoneLength) {
+                reject(line, "name or phone number is too long");
+            }
+            else {
+                batch.emplace_back(id, name, phoneNumber);
+                if (batch.size() == importBatchSize) {
+                    return flush();
+                }
+            }
+            return true;
+        };
+
+        if (endsWith(lowerCase(path), ".json")) {
+            JsonObjectReader reader(file);
+            vector<pair<string, string>> fields;
+            string error;
+            while (ok && reader.nextObject(fields, error)) {
+                string id, name, phoneNumber;
+                for (const auto& field : fields) {
+                    if (field.first == "id") {
+                        id = field.second;
+                    }
+                    else if (field.first == "name") {
+                        name = field.second;
+                    }
+                    else if (field.first == "phone" || field.first == "phoneNumber") {
+                        phoneNumber = field.second;
+                    }
+                }
+                ok = add(reader.line(), id, name, phoneNumber);
+            }
+            if (!error.empty()) {
+                cerr << path << ":" << reader.line() << ": " << error << endl;
+                ok = false;
+            }
+        }
+        else {
+            vector<string> fields;
+            size_t line = 0;
+            while (ok && readCsvRecord(file, fields, line)) {
+                if (fields.size() == 1 && fields[0].empty()) {
+                    continue;
+                }
+                if (imported + batch.size() + rejected == 0 && lowerCase(fields[0]) == "id") {
+                    continue;
+                }
+                if (fields.size() != 3) {
+                    reject(line, "expected 3 fields, found " + to_string(fields.size()));
+                    continue;
+                }
+                ok = add(line, fields[0], fields[1], fields[2]);
+            }
+        }
+        ok = ok && flush();
+        store.settleNames();
+
+        if (rejected > maxReportedErrors) {
+            cerr << "... and " << rejected - maxReportedErrors << " more rejected rows.\n";
+        }
+        cout << "Imported " << imported << " contacts from " << path << ", skipped " << rejected << ".\n";
+        return ok;
+    }
+
+    // Writes every contact as CSV, or as a JSON array when path ends in
+    // .json, straight from the store in large buffered writes.
+    bool exportContacts(const string& path) {
+        ofstream file(path, ios::binary);
+        if (!file.is_open()) {
+            cerr << "Error: Could not write to the file " << path << endl;
+            return false;
+        }
+
+        bool json = endsWith(lowerCase(path), ".json");
+        string out;
+        out.reserve(exportBufferSize + 512);
+        out += json ? "[" : "id,name,phone\n";
+        uint64_t exported = 0;
+        for (uint64_t slot = 0; slot < store.slotCount(); ++slot) {
+            if (!store.isLive(slot)) {
+                continue;
+            }
+            if (json) {
+                out += exported ? ",\n  {\"id\": " : "\n  {\"id\": ";
+                out += to_string(store.id(slot));
+                out += ", \"name\": ";
+                writeJsonString(out, store.name(slot));
+                out += ", \"phone\": ";
+                writeJsonString(out, store.phone(slot));
+                out += '}';
+            }
+            else {
+                out += to_string(store.id(slot));
+                out += ',';
+                writeCsvField(out, store.name(slot));
+                out += ',';
+                writeCsvField(out, store.phone(slot));
+                out += '\n';
+            }
+            ++exported;
+            if (out.size() >= exportBufferSize) {
+                file.write(out.data(), out.size());
+                out.clear();
+            }
+        }
+        if (json) {
+            out += exported ? "\n]\n" : "]\n";
+        }
+        file.write(out.data(), out.size());
+        file.close();
+        if (!file) {
+            cerr << "Error: Could not write to the file " << path << endl;
+            return false;
+        }
+        cout << "Exported " << exported << " contacts to " << path << ".\n";
+        return true;
+    }
+
+    // Prints groups of likely duplicates and returns every contact but the
+    // lowest id of each group.
+    vector<uint64_t> listDuplicates(size_t threads) {
+        vector<vector<uint64_t>> clusters = findDuplicateContacts(store, threads);
+        vector<uint64_t> extra;
+        if (clusters.empty()) {
+            cout << "No duplicate contacts found.\n";
+            return extra;
+        }
+        cout << setw(5) << "ID" << setw(20) << "Name" << setw(20) << "Phone Number" << endl;
+        for (const vector<uint64_t>& cluster : clusters) {
+            for (uint64_t slot : cluster) {
+                cout << setw(5) << store.id(slot) << setw(20) << store.name(slot) << setw(20) << store.phone(slot) << endl;
+            }
+            cout << endl;
+            extra.insert(extra.end(), cluster.begin() + 1, cluster.end());
+        }
+        cout << clusters.size() << " group(s) of duplicates, " << extra.size() << " extra contact(s).\n";
+        return extra;
+    }
+
+    // Erases the contacts in the given slots as one group commit.
+    bool removeContacts(const vector<uint64_t>& slots) {
+        vector<ContactChange> changes;
+        for (uint64_t slot : slots) {
+            changes.push_back(ContactChange{ false, store.id(slot), "", "" });
+        }
+        store.apply(changes);
+        size_t removed = count_if(changes.begin(), changes.end(), [](const ContactChange& change) { return change.ok; });
+        cout << "Removed " << removed << " contact(s).\n";
+        return removed == changes.size();
+    }
+
+    bool serve(const string& socketPath) {
+        return serveContacts(store, socketPath);
+    }
+
+    void importMenu() {
+        string path;
+        cout << "Enter file to import (.csv or .json): ";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, path);
+        importContacts(path);
+        pressAnyKeyToContinue();
+    }
+
+    void exportMenu() {
+        string path;
+        cout << "Enter file to export to (.csv or .json): ";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, path);
+        exportContacts(path);
+        pressAnyKeyToContinue();
+    }
+
+    void duplicatesMenu() {
+        vector<uint64_t> extra = listDuplicates(max(1u, thread::hardware_concurrency()));
+        if (!extra.empty()) {
+            char answer;
+            cout << "Remove the extra contacts, keeping the lowest ID of each group? (y/n): ";
+            cin >> answer;
+            if (answer == 'y' || answer == 'Y') {
+                removeContacts(extra);
+            }
+        }
+        pressAnyKeyToContinue();
+    }
+
     void pressAnyKeyToContinue() {
         cout << "\nPress any key to continue...";
         cin.ignore();
@@ -136,8 +2131,70 @@ public:
     }
 };
 
-int main() {
+void usage() {
+    cerr << "Usage: task-2 [--import FILE]... [--dedup] [--remove-duplicates] [--export FILE] [-j N]\n"
+         << "       task-2 --serve SOCKET\n"
+         << "  --import FILE        add contacts from a .csv (id,name,phone) or .json file\n"
+         << "  --dedup              list groups of likely duplicate contacts\n"
+         << "  --remove-duplicates  list them and keep only the lowest ID of each group\n"
+         << "  --export FILE        write all contacts to a .csv or .json file\n"
+         << "  -j N                 use N threads to find duplicates\n"
+         << "  --serve SOCKET       answer GET, ADD, DEL, PHONE, PREFIX and COUNT requests\n"
+         << "                       from concurrent clients on a Unix socket until stopped\n"
+         << "Actions run in the order given. Without arguments the menu is shown." << endl;
+    exit(1);
+}
+
+int runCommands(ContactManager& manager, int argc, char* argv[]) {
+    size_t threads = max(1u, thread::hardware_concurrency());
+    vector<pair<string, string>> actions;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--dedup" || arg == "--remove-duplicates") {
+            actions.emplace_back(arg, "");
+        }
+        else if (i + 1 >= argc) {
+            usage();
+        }
+        else if (arg == "--import" || arg == "--export" || arg == "--serve") {
+            actions.emplace_back(arg, argv[++i]);
+        }
+        else if (arg == "-j") {
+            threads = max(1, atoi(argv[++i]));
+        }
+        else {
+            usage();
+        }
+    }
+
+    for (const auto& action : actions) {
+        bool ok;
+        if (action.first == "--import") {
+            ok = manager.importContacts(action.second);
+        }
+        else if (action.first == "--export") {
+            ok = manager.exportContacts(action.second);
+        }
+        else if (action.first == "--serve") {
+            ok = manager.serve(action.second);
+        }
+        else {
+            vector<uint64_t> extra = manager.listDuplicates(threads);
+            ok = action.first == "--dedup" || manager.removeContacts(extra);
+        }
+        if (!ok) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     ContactManager manager;
+    if (argc > 1) {
+        return runCommands(manager, argc, argv);
+    }
+
     int choice;
 
     do {
@@ -152,7 +2209,11 @@ int main() {
         cout << "1. Add Contact\n";
         cout << "2. View Contacts\n";
         cout << "3. Delete Contact\n";
-        cout << "4. Exit\n";
+        cout << "4. Search Contacts\n";
+        cout << "5. Import Contacts\n";
+        cout << "6. Export Contacts\n";
+        cout << "7. Find Duplicates\n";
+        cout << "8. Exit\n";
         cout << "==============================\n";
         cout << "Enter your choice: ";
         cin >> choice;
@@ -168,13 +2229,25 @@ int main() {
             manager.deleteContact();
             break;
         case 4:
+            manager.searchContacts();
+            break;
+        case 5:
+            manager.importMenu();
+            break;
+        case 6:
+            manager.exportMenu();
+            break;
+        case 7:
+            manager.duplicatesMenu();
+            break;
+        case 8:
             cout << "Exiting...\n";
             break;
         default:
             cout << "Invalid choice. Please try again.";
             manager.pressAnyKeyToContinue();
         }
-    } while (choice != 4);
+    } while (choice != 8);
 
     return 0;
-}
\ No newline at end of file
+}